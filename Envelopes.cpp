@@ -17,6 +17,12 @@ Envelope::Envelope(const String& n, ElectroAudioProcessor& p,
 AudioComponent(n, p, vts, cEnvelopeParams, false),
 MappingSourceModel(p, n, true, false, Colours::deepskyblue)
 {
+    params.setRate(EnvelopeAttack, ControlRate);
+    params.setRate(EnvelopeDecay, ControlRate);
+    params.setRate(EnvelopeSustain, ControlRate);
+    params.setRate(EnvelopeRelease, ControlRate);
+    params.setRate(EnvelopeLeak, BlockRate);
+    
     for (int i = 0; i < processor.numInvParameterSkews; ++i)
     {
         sourceValues[i] = (float*) leaf_alloc(&processor.leaf, sizeof(float) * NUM_STRINGS);
@@ -24,6 +30,7 @@ MappingSourceModel(p, n, true, false, Colours::deepskyblue)
     }
     
     useVelocity = vts.getParameter(n + " Velocity");
+    afpGlobal = vts.getRawParameterValue(n + " Global");
     
     //exponential buffer rising from 0 to 1
     LEAF_generate_exp(expBuffer, 1000.0f, -1.0f, 0.0f, -0.0008f, EXP_BUFFER_SIZE);
@@ -43,6 +50,12 @@ MappingSourceModel(p, n, true, false, Colours::deepskyblue)
                     decayExpBuffer, DECAY_EXP_BUFFER_SIZE, &processor.leaf);
         tADSRT_setLeakFactor(&envs[i], ((1.0f - 0.1f) * 0.00005f) + 0.99995f);
     }
+    tADSRT_init(&globalEnv, expBuffer[0] * 8192.0f,
+                expBuffer[(int)(0.06f * expBufferSizeMinusOne)] * 8192.0f,
+                expBuffer[(int)(0.9f * expBufferSizeMinusOne)] * 8192.0f,
+                expBuffer[(int)(0.1f * expBufferSizeMinusOne)] * 8192.0f,
+                decayExpBuffer, DECAY_EXP_BUFFER_SIZE, &processor.leaf);
+    tADSRT_setLeakFactor(&globalEnv, ((1.0f - 0.1f) * 0.00005f) + 0.99995f);
 }
 
 Envelope::~Envelope()
@@ -56,6 +69,7 @@ Envelope::~Envelope()
     {
         tADSRT_free(&envs[i]);
     }
+    tADSRT_free(&globalEnv);
 }
 
 void Envelope::prepareToPlay (double sampleRate, int samplesPerBlock)
@@ -65,75 +79,121 @@ void Envelope::prepareToPlay (double sampleRate, int samplesPerBlock)
     {
         tADSRT_setSampleRate(&envs[i], sampleRate);
     }
+    tADSRT_setSampleRate(&globalEnv, sampleRate);
 }
 
 void Envelope::frame()
 {
-    sampleInBlock = 0;
+    AudioComponent::frame();
     // only enabled if it's actually being used as a source
-    enabled = processor.sourceMappingCounts[getName()] > 0;
+    enabled = isMapped();
+    
+    // Per voice unless the layout has the parameter
+    const bool wasGlobal = global;
+    global = afpGlobal != nullptr && *afpGlobal > 0.5f;
+    if (global == wasGlobal || heldVoices == 0) return;
+    
+    // Notes still held carry over into the new mode. The envelopes no
+    // longer ticked are released, so switching back can't resume them
+    // mid-note
+    if (global)
+    {
+        tADSRT_on(&globalEnv, lastVelocity);
+    }
+    else
+    {
+        tADSRT_off(&globalEnv);
+    }
+    for (int v = 0; v < NUM_STRINGS; ++v)
+    {
+        if (((heldVoices >> v) & 1u) == 0) continue;
+        if (global) tADSRT_off(&envs[v]);
+        else tADSRT_on(&envs[v], velocities[v]);
+    }
 }
 
 void Envelope::tick()
 {
     if (!enabled) return;
 //    float a = sampleInBlock * invBlockSize;
+    params.tick();
     
-    for (int v = 0; v < processor.numVoicesActive; v++)
+    if (global)
     {
-        float attack = quickParams[EnvelopeAttack][v]->tickNoSmoothing();
-        float decay = quickParams[EnvelopeDecay][v]->tickNoSmoothing();
-        float sustain = quickParams[EnvelopeSustain][v]->tickNoSmoothing();
-        float release = quickParams[EnvelopeRelease][v]->tickNoSmoothing();
-        float leak = quickParams[EnvelopeLeak][v]->tickNoSmoothing();
-        attack = attack < 0.f ? 0.f : attack;
-        decay = decay < 0.f ? 0.f : decay;
-        sustain = sustain < 0.f ? 0.f : sustain;
-        release = release < 0.f ? 0.f : release;
-        leak = leak < 0.f ? 0.f : leak;
-        
-//        tADSRT_setAttack(&envs[v], expBuffer[(int)(attack * expBufferSizeMinusOne)] * 8192.0f);
-//        tADSRT_setDecay(&envs[v], expBuffer[(int)(decay * expBufferSizeMinusOne)] * 8192.0f);
-//        tADSRT_setSustain(&envs[v], sustain);
-//        tADSRT_setRelease(&envs[v], expBuffer[(int)(release * expBufferSizeMinusOne)] * 8192.0f);
-        tADSRT_setAttack(&envs[v], attack);
-        tADSRT_setDecay(&envs[v], decay);
-        tADSRT_setSustain(&envs[v], sustain);
-        tADSRT_setRelease(&envs[v], release);
-        tADSRT_setLeakFactor(&envs[v], 0.99995f + 0.00005f*(1.f-leak));
-
-        float value = tADSRT_tickNoInterp(&envs[v]);
-        
-        sourceValues[0][v] = value;
-        for (int i = 1; i < processor.numInvParameterSkews; ++i)
+        sourceValues[0][0] = tickEnvelope(&globalEnv, 0);
+        computeSkews(1);
+        broadcast(NUM_STRINGS);
+    }
+    
+    // Voices going idle are only taken off the list once it's been walked
+    uint32 idleVoices = 0;
+    for (int v : state.activeVoices)
+    {
+        bool idle = globalEnv->whichStage == env_idle;
+        if (!global)
         {
-            float invSkew = processor.quickInvParameterSkews[i];
-            sourceValues[i][v] = powf(value, invSkew);
+            sourceValues[0][v] = tickEnvelope(&envs[v], v);
+            idle = envs[v]->whichStage == env_idle;
         }
         
         if (processor.strings[0]->numVoices > 1)
         {
             if (processor.strings[0]->voices[v][0] == -2)
             {
-                if (envs[v]->whichStage == env_idle)
+                if (idle)
                 {
                     tSimplePoly_deactivateVoice(&processor.strings[0], v);
                     processor.voiceIsSounding[v] = false;
+                    idleVoices |= 1u << v;
                 }
             }
         }
     }
-//    sampleInBlock++;
+    state.activeVoices.removeAll(idleVoices);
+    if (!global) computeSkews(processor.numVoicesActive);
+    sampleInBlock++;
+}
+
+float Envelope::tickEnvelope(tADSRT* env, int v)
+{
+    float attack = getParameterValue(EnvelopeAttack, v);
+    float decay = getParameterValue(EnvelopeDecay, v);
+    float sustain = getParameterValue(EnvelopeSustain, v);
+    float release = getParameterValue(EnvelopeRelease, v);
+    float leak = getParameterValue(EnvelopeLeak, v);
+    attack = attack < 0.f ? 0.f : attack;
+    decay = decay < 0.f ? 0.f : decay;
+    sustain = sustain < 0.f ? 0.f : sustain;
+    release = release < 0.f ? 0.f : release;
+    leak = leak < 0.f ? 0.f : leak;
+    
+//    tADSRT_setAttack(env, expBuffer[(int)(attack * expBufferSizeMinusOne)] * 8192.0f);
+//    tADSRT_setDecay(env, expBuffer[(int)(decay * expBufferSizeMinusOne)] * 8192.0f);
+//    tADSRT_setSustain(env, sustain);
+//    tADSRT_setRelease(env, expBuffer[(int)(release * expBufferSizeMinusOne)] * 8192.0f);
+    tADSRT_setAttack(env, attack);
+    tADSRT_setDecay(env, decay);
+    tADSRT_setSustain(env, sustain);
+    tADSRT_setRelease(env, release);
+    tADSRT_setLeakFactor(env, 0.99995f + 0.00005f*(1.f-leak));
+    
+    return tADSRT_tickNoInterp(env);
 }
 
 void Envelope::noteOn(int voice, float velocity)
 {
     if (useVelocity->getValue() == 0) velocity = 1.f;
-    tADSRT_on(&envs[voice], velocity);
+    velocities[voice] = velocity;
+    lastVelocity = velocity;
+    tADSRT_on(global ? &globalEnv : &envs[voice], velocity);
+    heldVoices |= 1u << voice;
     processor.voiceIsSounding[voice] = true;
+    state.activeVoices.add(voice);
 }
 
 void Envelope::noteOff(int voice, float velocity)
 {
-    tADSRT_off(&envs[voice]);
+    heldVoices &= ~(1u << voice);
+    if (!global) tADSRT_off(&envs[voice]);
+    else if (heldVoices == 0) tADSRT_off(&globalEnv);
 }
@@ -33,10 +33,23 @@ public:
     void noteOff(int voice, float velocity);
     
 private:
+    float tickEnvelope(tADSRT* env, int v);
+    
     RangedAudioParameter* useVelocity;
     
     tADSRT envs[NUM_STRINGS];
     
+    // Global mode runs one envelope for every voice on the first voice's
+    // parameters. It retriggers on each note-on and releases once no
+    // notes are held
+    std::atomic<float>* afpGlobal;
+    bool global = false;
+    tADSRT globalEnv;
+    uint32 heldVoices = 0;
+    // Kept to retrigger held notes when the mode changes
+    float velocities[NUM_STRINGS] = {};
+    float lastVelocity = 1.f;
+    
     float* sourceValues[MAX_NUM_UNIQUE_SKEWS];
     
     float expBuffer[EXP_BUFFER_SIZE];
@@ -16,6 +16,8 @@ Filter::Filter(const String& n, ElectroAudioProcessor& p,
                              AudioProcessorValueTreeState& vts) :
 AudioComponent(n, p, vts, cFilterParams, true)
 {    
+    params.setRate(FilterKeyFollow, ControlRate);
+    
     for (int i = 0; i < NUM_STRINGS; i++)
     {
         tSVF_init(&lowpass[i], SVFTypeLowpass, 2000.f, 0.7f, &processor.leaf);
@@ -56,7 +58,7 @@ void Filter::prepareToPlay (double sampleRate, int samplesPerBlock)
 
 void Filter::frame()
 {
-    sampleInBlock = 0;
+    AudioComponent::frame();
     enabled = afpEnabled == nullptr || *afpEnabled > 0;
     
     currentFilterType = FilterType(int(*afpFilterType));
@@ -108,12 +110,13 @@ void Filter::tick(float* samples)
     if (!enabled) return;
     
 //    float a = sampleInBlock * invBlockSize;
+    params.tick();
     
-    for (int v = 0; v < processor.numVoicesActive; ++v)
+    for (int v : state.activeVoices.audible())
     {
-        float midiCutoff = quickParams[FilterCutoff][v]->tickNoSmoothing();
-        float keyFollow = quickParams[FilterKeyFollow][v]->tickNoSmoothing();
-        float q = quickParams[FilterResonance][v]->tickNoSmoothing();
+        float midiCutoff = getParameterValue(FilterCutoff, v);
+        float keyFollow = getParameterValue(FilterKeyFollow, v);
+        float q = getParameterValue(FilterResonance, v);
         //float gain = quickParams[FilterGain][v]->tickNoSmoothing();
         LEAF_clip(0.f, keyFollow, 1.f);
         
@@ -0,0 +1,240 @@
+/*
+  ==============================================================================
+
+    OscillatorKernels.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+// Shape and lane kernels behind OscillatorBank, MorphOscillator and
+// NoiseBank. Kept free of JUCE so Tests/OscillatorBankBenchmark.cpp can
+// build them on their own. NUM_STRINGS must be defined first. The lane
+// loops are left to the auto-vectoriser, so need -O3 to pay off
+
+// Padded to the widest vector the bank kernels can be built for
+#define OSC_BANK_LANES ((NUM_STRINGS + 15) & ~15)
+
+#if defined(_MSC_VER)
+ #define OSC_KERNEL_INLINE __forceinline
+#else
+ #define OSC_KERNEL_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace OscillatorKernels
+{
+    // Nothing here compares floats. Compilers won't if-convert float selects
+    // (jmin and jmax included) under strict FP semantics, so conditions are
+    // built from abs, sign copies and int truncation to keep every loop
+    // branch-free and vectorisable
+    OSC_KERNEL_INLINE float maxOf(float a, float b)
+    {
+        return 0.5f * (a + b + std::abs(a - b));
+    }
+    
+    OSC_KERNEL_INLINE float minOf(float a, float b)
+    {
+        return 0.5f * (a + b - std::abs(a - b));
+    }
+    
+    // Residual for a step of +2 at phase 0, spread over one sample each side.
+    // Same as the usual two-branch PolyBLEP, written with clamps
+    OSC_KERNEL_INLINE float polyBlep(float t, float dt)
+    {
+        const float invDt = 1.f / (std::abs(dt) + 1.0e-7f);
+        const float early = maxOf(1.f - t * invDt, 0.f);
+        const float late = maxOf((t - 1.f) * invDt + 1.f, 0.f);
+        return late * late - early * early;
+    }
+    
+    // Residual for a unit change of slope per sample at phase 0, the
+    // integral of PolyBLEP's. Rounds off the corners of a triangle
+    OSC_KERNEL_INLINE float polyBlamp(float t, float dt)
+    {
+        const float invDt = 1.f / (std::abs(dt) + 1.0e-7f);
+        const float early = maxOf(1.f - t * invDt, 0.f);
+        const float late = maxOf((t - 1.f) * invDt + 1.f, 0.f);
+        return (early * early * early + late * late * late) * (1.f / 6.f);
+    }
+    
+    // Wraps a phase in [-1, 2) into [0, 1)
+    OSC_KERNEL_INLINE float wrapPhase(float t)
+    {
+        const float u = t + 1.f;
+        return u - (float) (int) u;
+    }
+    
+    OSC_KERNEL_INLINE float sawOf(float t, float dt)
+    {
+        return 2.f * t - 1.f - polyBlep(t, dt);
+    }
+    
+    OSC_KERNEL_INLINE float pulseOf(float t, float dt, float w)
+    {
+        // t - t2 is w before the falling edge and w - 1 after it
+        const float t2 = wrapPhase(t - w);
+        const float naive = 2.f * w - 2.f * (t - t2) - 1.f;
+        return naive + polyBlep(t, dt) - polyBlep(t2, dt);
+    }
+    
+    OSC_KERNEL_INLINE float triangleOf(float t, float dt, float width)
+    {
+        const float w = maxOf(0.0001f, minOf(0.9999f, width));
+        // Each side is the lower of the two lines
+        const float up = 2.f * t / w - 1.f;
+        const float down = 1.f - 2.f * (t - w) / (1.f - w);
+        // The slope turns up at 0 and back down at w by the same amount
+        const float t2 = wrapPhase(t - w);
+        const float turn = 2.f * dt / (w * (1.f - w));
+        return minOf(up, down) + turn * (polyBlamp(t, dt) - polyBlamp(t2, dt));
+    }
+    
+    OSC_KERNEL_INLINE float sineOf(float t)
+    {
+        // sin(2pi t) = -sin(z) for z in [-pi, pi). Fold |z| into
+        // [0, pi/2], evaluate, and put the sign back
+        const float halfPi = 1.57079633f;
+        const float z = (t - 0.5f) * 6.28318531f;
+        const float u = halfPi - std::abs(halfPi - std::abs(z));
+        const float u2 = u * u;
+        const float s = u * (1.f + u2 * (-1.66666667e-1f + u2 * (8.33333333e-3f +
+                             u2 * (-1.98412698e-4f + u2 * 2.75573192e-6f))));
+        return -std::copysign(s, z);
+    }
+    
+    // Saw and square from one phase. Both step up at phase 0, so that BLEP
+    // is only worked out once
+    OSC_KERNEL_INLINE float sawPulseOf(float t, float dt, float mix)
+    {
+        const float rising = polyBlep(t, dt);
+        const float t2 = wrapPhase(t - 0.5f);
+        const float saw = 2.f * t - 1.f - rising;
+        const float pulse = -2.f * (t - t2) + rising - polyBlep(t2, dt);
+        return saw + mix * (pulse - saw);
+    }
+    
+    OSC_KERNEL_INLINE float sineTriOf(float t, float dt, float mix)
+    {
+        const float sine = sineOf(t);
+        return sine + mix * (triangleOf(t, dt, 0.5f) - sine);
+    }
+    
+    OSC_KERNEL_INLINE void sawLanes(const float* phase, const float* inc, float* out)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            out[v] = sawOf(phase[v], inc[v]);
+        }
+    }
+    
+    OSC_KERNEL_INLINE void pulseLanes(const float* phase, const float* inc, const float* width, float* out)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            out[v] = pulseOf(phase[v], inc[v], width[v]);
+        }
+    }
+    
+    OSC_KERNEL_INLINE void triangleLanes(const float* phase, const float* inc, const float* width, float* out)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            out[v] = triangleOf(phase[v], inc[v], width[v]);
+        }
+    }
+    
+    OSC_KERNEL_INLINE void sineLanes(const float* phase, float* out)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            out[v] = sineOf(phase[v]);
+        }
+    }
+    
+    OSC_KERNEL_INLINE void sawPulseLanes(const float* phase, const float* inc, const float* mix, float* out)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            out[v] = sawPulseOf(phase[v], inc[v], mix[v]);
+        }
+    }
+    
+    OSC_KERNEL_INLINE void sineTriLanes(const float* phase, const float* inc, const float* mix, float* out)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            out[v] = sineTriOf(phase[v], inc[v], mix[v]);
+        }
+    }
+    
+    // One step of Simper's trapezoidal SVF, the same one tSVF runs, giving
+    // the bandpass output in place of the input
+    OSC_KERNEL_INLINE void bandpassLanes(float* ic1, float* ic2, const float* a1, const float* a2,
+                                         const float* a3, float* io)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            const float v3 = io[v] - ic2[v];
+            const float v1 = a1[v] * ic1[v] + a2[v] * v3;
+            const float v2 = ic2[v] + a2[v] * ic1[v] + a3[v] * v3;
+            ic1[v] = 2.f * v1 - ic1[v];
+            ic2[v] = 2.f * v2 - ic2[v];
+            io[v] = v1;
+        }
+    }
+    
+    OSC_KERNEL_INLINE void xorshiftLanes(uint32_t* state, float* out)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            uint32_t x = state[v];
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            state[v] = x;
+            out[v] = (float) (int32_t) x * (1.f / 2147483648.f);
+        }
+    }
+    
+    OSC_KERNEL_INLINE void advanceLanes(float* phase, const float* inc)
+    {
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            phase[v] = wrapPhase(phase[v] + inc[v]);
+        }
+    }
+}
+
+// A single voice of the bank's saw/square and sine/triangle morphs. Both
+// shapes of a pair come from one phase accumulator, so they stay in phase
+// without a second oscillator, and the saw and square share the BLEP on
+// their common rising edge
+class MorphOscillator
+{
+public:
+    void setSampleRate(float sampleRate) { invSampleRate = 1.f / sampleRate; }
+    void setFreq(float freq) { inc = freq * invSampleRate; }
+    
+    float tickSawPulse(float mix)
+    {
+        const float out = OscillatorKernels::sawPulseOf(phase, inc, mix);
+        phase = OscillatorKernels::wrapPhase(phase + inc);
+        return out;
+    }
+    
+    float tickSineTri(float mix)
+    {
+        const float out = OscillatorKernels::sineTriOf(phase, inc, mix);
+        phase = OscillatorKernels::wrapPhase(phase + inc);
+        return out;
+    }
+    
+private:
+    float phase = 0.f;
+    float inc = 0.f;
+    float invSampleRate = 1.f / 44100.f;
+};
@@ -13,6 +13,120 @@
 
 //==============================================================================
 
+using namespace OscillatorKernels;
+
+// Lanes go in blocks of OSC_BANK_LANES so the inner loops keep a fixed trip
+// count, which vectorises better than looping over all n
+#define OSC_BANK_FOR_BLOCKS(n) for (int b = 0; b < n; b += OSC_BANK_LANES)
+#define OSC_BANK_KERNELS(isa, target) \
+target static void saw##isa(const float* p, const float* i, float* o, int n) { OSC_BANK_FOR_BLOCKS(n) sawLanes(p + b, i + b, o + b); } \
+target static void pulse##isa(const float* p, const float* i, const float* w, float* o, int n) { OSC_BANK_FOR_BLOCKS(n) pulseLanes(p + b, i + b, w + b, o + b); } \
+target static void triangle##isa(const float* p, const float* i, const float* w, float* o, int n) { OSC_BANK_FOR_BLOCKS(n) triangleLanes(p + b, i + b, w + b, o + b); } \
+target static void sine##isa(const float* p, float* o, int n) { OSC_BANK_FOR_BLOCKS(n) sineLanes(p + b, o + b); } \
+target static void sawPulse##isa(const float* p, const float* i, const float* m, float* o, int n) { OSC_BANK_FOR_BLOCKS(n) sawPulseLanes(p + b, i + b, m + b, o + b); } \
+target static void sineTri##isa(const float* p, const float* i, const float* m, float* o, int n) { OSC_BANK_FOR_BLOCKS(n) sineTriLanes(p + b, i + b, m + b, o + b); } \
+target static void advance##isa(float* p, const float* i, int n) { OSC_BANK_FOR_BLOCKS(n) advanceLanes(p + b, i + b); } \
+static const OscillatorBank::Kernels kernels##isa { saw##isa, pulse##isa, triangle##isa, sine##isa, \
+    sawPulse##isa, sineTri##isa, advance##isa };
+
+// The baseline build is SSE2 on x86-64 and NEON on arm64
+OSC_BANK_KERNELS(Baseline, )
+#if JUCE_INTEL && (JUCE_GCC || JUCE_CLANG)
+ #define OSC_BANK_MULTI_ISA 1
+OSC_BANK_KERNELS(AVX2, __attribute__((target("avx2"))))
+OSC_BANK_KERNELS(AVX512, __attribute__((target("avx512f"))))
+#endif
+
+static const OscillatorBank::Kernels& chooseOscillatorBankKernels()
+{
+#if OSC_BANK_MULTI_ISA
+    if (SystemStats::hasAVX512F()) return kernelsAVX512;
+    if (SystemStats::hasAVX2()) return kernelsAVX2;
+#endif
+    return kernelsBaseline;
+}
+
+OscillatorBank::OscillatorBank() :
+kernels(chooseOscillatorBankKernels())
+{
+    for (int v = 0; v < OSC_BANK_MAX_LANES; ++v)
+    {
+        phase[v] = 0.f;
+        inc[v] = 0.f;
+    }
+}
+
+void OscillatorBank::setSampleRate(float sampleRate)
+{
+    invSampleRate = 1.f / sampleRate;
+}
+
+void OscillatorBank::renderSaw(float* out)
+{
+    kernels.saw(phase, inc, out, numLanes);
+}
+
+void OscillatorBank::renderPulse(float* out, const float* width)
+{
+    kernels.pulse(phase, inc, width, out, numLanes);
+}
+
+void OscillatorBank::renderTriangle(float* out, const float* width)
+{
+    kernels.triangle(phase, inc, width, out, numLanes);
+}
+
+void OscillatorBank::renderSine(float* out)
+{
+    kernels.sine(phase, out, numLanes);
+}
+
+void OscillatorBank::renderSawPulse(float* out, const float* mix)
+{
+    kernels.sawPulse(phase, inc, mix, out, numLanes);
+}
+
+void OscillatorBank::renderSineTri(float* out, const float* mix)
+{
+    kernels.sineTri(phase, inc, mix, out, numLanes);
+}
+
+void OscillatorBank::advance()
+{
+    kernels.advance(phase, inc, numLanes);
+}
+
+void OscillatorBank::advance(int numSamples)
+{
+    for (int v = 0; v < numLanes; ++v)
+    {
+        setPhase(v, phase[v] + inc[v] * numSamples);
+    }
+}
+
+//==============================================================================
+
+void NoiseBank::setSeed(uint32 seed)
+{
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        // Murmur3's finaliser, so nearby seeds and lanes start far apart.
+        // xorshift never leaves a zero state, so that one is swapped out
+        uint32 z = seed + (uint32) v * 0x9E3779B9u;
+        z = (z ^ (z >> 16)) * 0x85EBCA6Bu;
+        z = (z ^ (z >> 13)) * 0xC2B2AE35u;
+        z ^= z >> 16;
+        state[v] = z != 0 ? z : 0x6D2B79F5u;
+    }
+}
+
+void NoiseBank::render(float* out)
+{
+    xorshiftLanes(state, out);
+}
+
+//==============================================================================
+
 Oscillator::Oscillator(const String& n, ElectroAudioProcessor& p,
                        AudioProcessorValueTreeState& vts) :
 AudioComponent(n, p, vts, cOscParams, true),
@@ -31,240 +145,1217 @@ MappingSourceModel(p, n, true, true, Colours::darkorange)
         tCycle_init(&sine[i], &processor.leaf);
         tMBTriangle_init(&tri[i], &processor.leaf);
         
-        tMBSaw_init(&sawPaired[i], &processor.leaf);
-        tMBPulse_init(&pulsePaired[i], &processor.leaf);
-        tCycle_init(&sinePaired[i], &processor.leaf);
-        tMBTriangle_init(&triPaired[i], &processor.leaf);
+        tOversampler_init(&decimator[i], OSC_HIGH_QUALITY_RATIO, 0, &processor.leaf);
+    }
+    
+    for (int v = 0; v < OSC_BANK_MAX_LANES; ++v)
+    {
+        ecoShapes[v] = 0.f;
+        // Spread the starting phases so unison copies don't begin in step
+        bank.setPhase(v, v * 0.618034f);
     }
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        ecoAmps[v] = 0.f;
+        spreadSamples[v] = 0.f;
+    }
+    setUnison(1);
+    
+    waveTableLoader->addOscillator(this);
     
     filterSend = std::make_unique<SmoothedParameter>(p, vts, n + " FilterSend");
     isHarmonic_raw = vts.getRawParameterValue(n + " isHarmonic");
     isStepped_raw = vts.getRawParameterValue(n + " isStepped");
     afpShapeSet = vts.getRawParameterValue(n + " ShapeSet");
+    afpQuality = vts.getRawParameterValue(n + " Quality");
+    afpUnison = vts.getRawParameterValue(n + " Unison");
+    afpDetune = vts.getRawParameterValue(n + " Detune");
+    afpSpread = vts.getRawParameterValue(n + " Spread");
+}
+
+Oscillator::~Oscillator()
+{
+    waveTableLoader->removeOscillator(this);
+    {
+        const ScopedLock jl(waveTableLoader->getJobLock());
+        collectRetiredWaveTableSets();
+        freeWaveTableSet(pendingWaveSet.exchange(nullptr));
+        freeWaveTableSet(waveSet);
+    }
+    
+    for (int i = 0; i < processor.numInvParameterSkews; ++i)
+    {
+        leaf_free(&processor.leaf, (char*)sourceValues[i]);
+    }
+    
+    for (int i = 0; i < NUM_STRINGS; i++)
+    {
+        tMBSaw_free(&saw[i]);
+        tMBPulse_free(&pulse[i]);
+        tCycle_free(&sine[i]);
+        tMBTriangle_free(&tri[i]);
+        
+        tOversampler_free(&decimator[i]);
+    }
+    DBG("Post exit: " + String(processor.leaf.allocCount) + " " + String(processor.leaf.freeCount));
+}
+
+void Oscillator::prepareToPlay (double sampleRate, int samplesPerBlock)
+{
+    AudioComponent::prepareToPlay(sampleRate, samplesPerBlock);
+    bank.setSampleRate(sampleRate);
+    setQuality(quality);
+    // Sets are only built for one rate, so load the current file again
+    if (waveSampleRate.exchange(sampleRate) != sampleRate && waveTableFile.exists())
+    {
+        waveTableLoader->request(this, waveTableFile);
+    }
+    filterSendBlock.allocate(samplesPerBlock, true);
+    voiceBlock.allocate(samplesPerBlock * OSC_HIGH_QUALITY_RATIO, true);
+}
+
+void Oscillator::frame()
+{
+    AudioComponent::frame();
+    enabled = afpEnabled == nullptr || *afpEnabled > 0 ||
+    isMapped();
+    
+    // Pick up a newly loaded wavetable at the block boundary. The old set
+    // can't be freed here, so push it on the retired list for the loader
+    if (WaveTableSet* newSet = pendingWaveSet.exchange(nullptr, std::memory_order_acquire))
+    {
+        retireWaveTableSet(waveSet);
+        waveSet = newSet;
+    }
+    if (waveSet != nullptr && waveSet->sampleRate != currentSampleRate)
+    {
+        // Resampling would rebuild tables other sets share, and allocate,
+        // so stay silent until the set prepareToPlay() asked for arrives
+        retireWaveTableSet(waveSet);
+        waveSet = nullptr;
+    }
+    
+    // An MTS-ESP master can retune without notice, so re-query once a block
+    if (processor.tuner.getIsMTS())
+    {
+        for (int v = 0; v < NUM_STRINGS; ++v) frequencyCache[v].valid = false;
+    }
+    
+    currentShapeSet = OscShapeSet(int(*afpShapeSet));
+    switch (currentShapeSet) {
+        case SawPulseOscShapeSet:
+            shapeTick = &Oscillator::sawSquareTick;
+            shapeBlock = &Oscillator::sawSquareBlock;
+            ecoTick = &Oscillator::ecoSawSquareTick;
+            break;
+            
+        case SineTriOscShapeSet:
+            shapeTick = &Oscillator::sineTriTick;
+            shapeBlock = &Oscillator::sineTriBlock;
+            ecoTick = &Oscillator::ecoSineTriTick;
+            break;
+            
+        case SawOscShapeSet:
+            shapeTick = &Oscillator::sawTick;
+            shapeBlock = &Oscillator::sawBlock;
+            ecoTick = &Oscillator::ecoSawTick;
+            break;
+            
+        case PulseOscShapeSet:
+            shapeTick = &Oscillator::pulseTick;
+            shapeBlock = &Oscillator::pulseBlock;
+            ecoTick = &Oscillator::ecoPulseTick;
+            break;
+            
+        case SineOscShapeSet:
+            shapeTick = &Oscillator::sineTick;
+            shapeBlock = &Oscillator::sineBlock;
+            ecoTick = &Oscillator::ecoSineTick;
+            break;
+            
+        case TriOscShapeSet:
+            shapeTick = &Oscillator::triTick;
+            shapeBlock = &Oscillator::triBlock;
+            ecoTick = &Oscillator::ecoTriTick;
+            break;
+            
+        case UserOscShapeSet:
+            shapeTick = &Oscillator::userTick;
+            shapeBlock = &Oscillator::userBlock;
+            ecoTick = &Oscillator::ecoSawSquareTick;
+            break;
+            
+        default:
+            shapeTick = &Oscillator::sawSquareTick;
+            shapeBlock = &Oscillator::sawSquareBlock;
+            ecoTick = &Oscillator::ecoSawSquareTick;
+            break;
+    }
+    
+    targetQuality = afpQuality == nullptr ? StandardOscQuality :
+    OscQuality(jlimit(0, int(OscQualityNil) - 1, int(*afpQuality)));
+    targetUnison = afpUnison == nullptr ? 1 : jlimit(1, OSC_MAX_UNISON, int(*afpUnison));
+    // Detune and spread change smoothly, so needn't wait for a fade
+    setUnisonSpread(afpDetune == nullptr ? 0.f : afpDetune->load(),
+                    afpSpread == nullptr ? 0.f : afpSpread->load());
+    if (!enabled)
+    {
+        // Nothing to hear, so switch straight away
+        if (quality != targetQuality) setQuality(targetQuality);
+        if (unison != targetUnison) setUnison(targetUnison);
+        qualityGain = 1.f;
+        qualityGainStep = 0.f;
+        return;
+    }
+    if (targetQuality != quality || targetUnison != unison)
+    {
+        qualityGainStep = -1.f / OSC_QUALITY_FADE_LENGTH;
+    }
+    else if (qualityGain < 1.f)
+    {
+        // Changed back before the old quality had faded out
+        qualityGainStep = 1.f / OSC_QUALITY_FADE_LENGTH;
+    }
+    
+    filterSend->advance(samplesInLastBlock);
+    filterSend->tickBlockNoHooks(filterSendBlock, currentBlockSize);
+}
+
+void Oscillator::tick(float output[][NUM_STRINGS])
+{
+    if (!enabled) return;
+    
+    params.tick();
+    
+    float f = sampleInBlock < currentBlockSize ?
+    filterSendBlock[sampleInBlock] : filterSend->tickNoHooks();
+    
+    const bool eco = usesBank();
+    const bool high = isHigh();
+    if (eco)
+    {
+        setBankLanes();
+        renderBank();
+    }
+
+    for (int v : state.activeVoices)
+    {
+        
+        float sample = 0.0f;
+        float amp;
+        
+        if (eco)
+        {
+            sample = samplesA[v];
+            amp = ecoAmps[v];
+        }
+        else
+        {
+            float shape = getParameterValue(OscShape, v);
+            amp = getParameterValue(OscAmp, v);
+            
+            amp = amp < 0.f ? 0.f : amp;
+            float finalFreq = getVoiceFrequency(v);
+            
+            shape = LEAF_clip(0.f, shape, 1.f);
+            if (high)
+            {
+                float up[OSC_HIGH_QUALITY_RATIO] = {};
+                for (int k = 0; k < OSC_HIGH_QUALITY_RATIO; ++k)
+                {
+                    (this->*shapeTick)(up[k], v, finalFreq, shape);
+                }
+                sample = tOversampler_downsample(&decimator[v], up);
+            }
+            else
+            {
+                (this->*shapeTick)(sample, v, finalFreq, shape);
+            }
+        }
+    
+        sample *= amp;
+        
+        float normSample = (sample + 1.f) * 0.5f;
+        sourceValues[0][v] = normSample;
+        
+        sample *= INV_NUM_OSCS * qualityGain;
+        
+        if (unison > 1)
+        {
+            // Copies fan out around the send position without leaving [0, 1]
+            float d = spreadSamples[v] * amp * INV_NUM_OSCS * qualityGain * jmin(f, 1.f-f);
+            output[0][v] += (sample*f + d) * *afpEnabled;
+            output[1][v] += (sample*(1.f-f) - d) * *afpEnabled;
+            continue;
+        }
+        
+        output[0][v] += sample*f * *afpEnabled;
+        output[1][v] += sample*(1.f-f) * *afpEnabled ;
+    }
+    computeSkews(processor.numVoicesActive);
+    
+    if (qualityGainStep != 0.f) advanceQualityFade();
+    
+    sampleInBlock++;
+}
+
+bool Oscillator::canProcessBlock()
+{
+    return !isMapped() && params.isStatic() && qualityGainStep == 0.f;
+}
+
+void Oscillator::processBlock(float* const f1Sends[NUM_STRINGS], float* const f2Sends[NUM_STRINGS],
+                              int numSamples)
+{
+    if (!enabled) return;
+    jassert(canProcessBlock());
+    jassert(sampleInBlock + numSamples <= currentBlockSize);
+    
+    params.skip(numSamples);
+    
+    const float* f = filterSendBlock + sampleInBlock;
+    const float enabledGain = *afpEnabled;
+    
+    if (usesBank())
+    {
+        // The bank renders all voices a sample at a time, so go by sample
+        setBankLanes();
+        for (int i = 0; i < numSamples; ++i)
+        {
+            renderBank();
+            const float m = jmin(f[i], 1.f-f[i]);
+            for (int v : state.activeVoices)
+            {
+                float sample = samplesA[v] * ecoAmps[v];
+                sample *= INV_NUM_OSCS;
+                float d = unison > 1 ? spreadSamples[v] * ecoAmps[v] * INV_NUM_OSCS * m : 0.f;
+                f1Sends[v][i] += (sample*f[i] + d) * enabledGain;
+                f2Sends[v][i] += (sample*(1.f-f[i]) - d) * enabledGain;
+            }
+        }
+        for (int v : state.activeVoices)
+        {
+            sourceValues[0][v] = (samplesA[v] * ecoAmps[v] + 1.f) * 0.5f;
+        }
+        computeSkews(processor.numVoicesActive);
+        sampleInBlock += numSamples;
+        return;
+    }
+    
+    const bool high = isHigh();
+    for (int v : state.activeVoices)
+    {
+        
+        float shape = getParameterValue(OscShape, v);
+        float amp = getParameterValue(OscAmp, v);
+        
+        amp = amp < 0.f ? 0.f : amp;
+        float finalFreq = getVoiceFrequency(v);
+        
+        shape = LEAF_clip(0.f, shape, 1.f);
+        if (high)
+        {
+            // Decimating in place is safe since sample i only reads from i on
+            (this->*shapeBlock)(voiceBlock, v, finalFreq, shape, numSamples * OSC_HIGH_QUALITY_RATIO);
+            for (int i = 0; i < numSamples; ++i)
+            {
+                voiceBlock[i] = tOversampler_downsample(&decimator[v],
+                                                        voiceBlock + i * OSC_HIGH_QUALITY_RATIO);
+            }
+        }
+        else
+        {
+            (this->*shapeBlock)(voiceBlock, v, finalFreq, shape, numSamples);
+        }
+        
+        // Same operations in the same order as tick() so the output matches
+        float* f1 = f1Sends[v];
+        float* f2 = f2Sends[v];
+        for (int i = 0; i < numSamples; ++i)
+        {
+            float sample = voiceBlock[i] * amp;
+            sample *= INV_NUM_OSCS;
+            f1[i] += sample*f[i] * enabledGain;
+            f2[i] += sample*(1.f-f[i]) * enabledGain;
+        }
+        sourceValues[0][v] = (voiceBlock[numSamples-1] * amp + 1.f) * 0.5f;
+    }
+    computeSkews(processor.numVoicesActive);
+    sampleInBlock += numSamples;
+}
+
+void Oscillator::setQuality(OscQuality q)
+{
+    quality = q;
+    const double rate = currentSampleRate * (q == HighOscQuality ? OSC_HIGH_QUALITY_RATIO : 1);
+    for (int i = 0; i < NUM_STRINGS; i++)
+    {
+        tMBSaw_setSampleRate(&saw[i], rate);
+        tMBPulse_setSampleRate(&pulse[i], rate);
+        tCycle_setSampleRate(&sine[i], rate);
+        tMBTriangle_setSampleRate(&tri[i], rate);
+        morph[i].setSampleRate(rate);
+    }
+}
+
+void Oscillator::setUnison(int n)
+{
+    unison = n;
+    unisonGain = 1.f / std::sqrt((float) n);
+    bank.setNumLanes(n * OSC_BANK_LANES);
+    setUnisonSpread(unisonDetune, unisonSpread);
+}
+
+void Oscillator::setUnisonSpread(float detuneCents, float spread)
+{
+    unisonDetune = detuneCents;
+    unisonSpread = spread;
+    for (int u = 0; u < unison; ++u)
+    {
+        // Evenly placed in [-1, 1], outermost copies at the full amount
+        float position = unison > 1 ? 2.f * u / (unison - 1) - 1.f : 0.f;
+        unisonRatios[u] = std::exp2(detuneCents * position * (1.f / 1200.f));
+        unisonOffsets[u] = spread * position;
+    }
+}
+
+void Oscillator::advanceQualityFade()
+{
+    qualityGain += qualityGainStep;
+    if (qualityGain <= 0.f)
+    {
+        // Silent now, so the generators can be swapped
+        qualityGain = 0.f;
+        setQuality(targetQuality);
+        setUnison(targetUnison);
+        qualityGainStep = 1.f / OSC_QUALITY_FADE_LENGTH;
+    }
+    else if (qualityGain >= 1.f)
+    {
+        qualityGain = 1.f;
+        qualityGainStep = 0.f;
+    }
+}
+
+void Oscillator::setBankLanes()
+{
+    // Parameters and pitch are worked out once per voice, however many copies
+    for (int v : state.activeVoices)
+    {
+        float shape = getParameterValue(OscShape, v);
+        float amp = getParameterValue(OscAmp, v);
+        float freq = getVoiceFrequency(v);
+        
+        shape = LEAF_clip(0.f, shape, 1.f);
+        for (int u = 0; u < unison; ++u)
+        {
+            const int lane = u * OSC_BANK_LANES + v;
+            bank.setFreq(lane, freq * unisonRatios[u]);
+            ecoShapes[lane] = shape;
+        }
+        ecoAmps[v] = amp < 0.f ? 0.f : amp;
+    }
+}
+
+void Oscillator::renderBank()
+{
+    (this->*ecoTick)(samplesA);
+    bank.advance();
+    if (unison == 1) return;
+    
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        spreadSamples[v] = samplesA[v] * unisonOffsets[0];
+    }
+    for (int u = 1; u < unison; ++u)
+    {
+        const float* copy = samplesA + u * OSC_BANK_LANES;
+        const float offset = unisonOffsets[u];
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            samplesA[v] += copy[v];
+            spreadSamples[v] += copy[v] * offset;
+        }
+    }
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        samplesA[v] *= unisonGain;
+        spreadSamples[v] *= unisonGain;
+    }
+}
+
+void Oscillator::ecoSawSquareTick(float* samples)
+{
+    bank.renderSawPulse(samples, ecoShapes);
+}
+
+void Oscillator::ecoSineTriTick(float* samples)
+{
+    bank.renderSineTri(samples, ecoShapes);
+}
+
+void Oscillator::ecoSawTick(float* samples)
+{
+    bank.renderSaw(samples);
+}
+
+void Oscillator::ecoPulseTick(float* samples)
+{
+    bank.renderPulse(samples, ecoShapes);
+}
+
+void Oscillator::ecoSineTick(float* samples)
+{
+    bank.renderSine(samples);
+}
+
+void Oscillator::ecoTriTick(float* samples)
+{
+    bank.renderTriangle(samples, ecoShapes);
+}
+
+float Oscillator::getVoiceFrequency(int v)
+{
+    float harm_pitch = getParameterValue(OscPitch, v);
+    float fine = getParameterValue(OscFine, v);
+    float freq = getParameterValue(OscFreq, v);
+    
+    float note = processor.voiceNote[v];
+    if (isStepped_raw == nullptr || *isStepped_raw > 0)
+    {
+        harm_pitch = round(harm_pitch);
+    }
+    bool harmonicMode = isHarmonic_raw == nullptr || *isHarmonic_raw > 0;
+    uint32 generation = processor.tuner.getGeneration();
+    
+    FrequencyCacheEntry& cache = frequencyCache[v];
+    if (cache.valid && cache.note == note && cache.harmonic == harm_pitch &&
+        cache.fine == fine && cache.freq == freq && cache.harmonicMode == harmonicMode &&
+        cache.tuningGeneration == generation)
+    {
+        return cache.result;
+    }
+    cache.note = note;
+    cache.harmonic = harm_pitch;
+    cache.fine = fine;
+    cache.freq = freq;
+    cache.harmonicMode = harmonicMode;
+    cache.tuningGeneration = generation;
+    cache.valid = true;
+    
+    // Modulated pitch misses the cache every sample, so skip the tuner for
+    // 12-TET and work in log2 directly. MTS-ESP has to go through the tuner
+    if (!processor.tuner.getIsMTS() &&
+        (params.isModulated(OscPitch) || params.isModulated(OscFine) || params.isModulated(OscFreq)))
+    {
+        if (harmonicMode)
+        {
+            // ftom(mtof(note) * n) is just note + 12 * log2(n)
+            note += harm_pitch >= 0 ? 12.f * SkewCurve::fastLog2(harm_pitch + 1) : -12.f * SkewCurve::fastLog2(1 - harm_pitch);
+            harm_pitch = 0;
+        }
+        float midi = LEAF_clip(0, note + harm_pitch + fine*0.01f, 127);
+        return cache.result = 440.f * SkewCurve::fastExp2((midi - 69.f) * (1.f / 12.f)) + freq;
+    }
+    
+    if (harmonicMode)
+    {
+        note = harm_pitch >= 0 ? ftom(processor.tuner.mtof(note) * (harm_pitch + 1)) : ftom(processor.tuner.mtof(note) / abs((harm_pitch - 1)));
+        harm_pitch = 0;
+    }
+    //DBG(ftom(processor.tuner.mtof(note) / (harm - 1)));
+    //DBG(processor.tuner.mtof(note) / (harm - 1));
+    return cache.result = processor.tuner.mtof(LEAF_clip(0, note + harm_pitch + fine*0.01f, 127)) + freq;
+}
+
+void Oscillator::sawSquareTick(float& sample, int v, float freq, float shape)
+{
+    morph[v].setFreq(freq);
+    sample += morph[v].tickSawPulse(shape);
+}
+
+void Oscillator::sineTriTick(float& sample, int v, float freq, float shape)
+{
+    morph[v].setFreq(freq);
+    sample += morph[v].tickSineTri(shape);
+}
+
+void Oscillator::sawTick(float& sample, int v, float freq, float shape)
+{
+    tMBSaw_setFreq(&saw[v], freq);
+    sample += tMBSaw_tick(&saw[v]) * 2.f;;
+}
+
+void Oscillator::pulseTick(float& sample, int v, float freq, float shape)
+{
+    tMBPulse_setFreq(&pulse[v], freq);
+    tMBPulse_setWidth(&pulse[v], shape);
+    sample += tMBPulse_tick(&pulse[v]) * 2.f;;
+}
+
+void Oscillator::sineTick(float& sample, int v, float freq, float shape)
+{
+    tCycle_setFreq(&sine[v], freq);
+    sample += tCycle_tick(&sine[v]);
+}
+
+void Oscillator::triTick(float& sample, int v, float freq, float shape)
+{
+    tMBTriangle_setFreq(&tri[v], freq);
+    tMBTriangle_setWidth(&tri[v], shape);
+    sample += tMBTriangle_tick(&tri[v]) * 2.f;;
+}
+
+void Oscillator::userTick(float& sample, int v, float freq, float shape)
+{
+    // Silent until the first set has been loaded
+    if (waveSet == nullptr) return;
+    tWaveOscS* wave = &waveSet->wave[v];
+    tWaveOscS_setFreq(wave, freq);
+    tWaveOscS_setIndex(wave, shape);
+    sample += tWaveOscS_tick(wave);
+}
+
+void Oscillator::sawSquareBlock(float* out, int v, float freq, float shape, int numSamples)
+{
+    morph[v].setFreq(freq);
+    for (int i = 0; i < numSamples; ++i)
+    {
+        out[i] = morph[v].tickSawPulse(shape);
+    }
+}
+
+void Oscillator::sineTriBlock(float* out, int v, float freq, float shape, int numSamples)
+{
+    morph[v].setFreq(freq);
+    for (int i = 0; i < numSamples; ++i)
+    {
+        out[i] = morph[v].tickSineTri(shape);
+    }
+}
+
+void Oscillator::sawBlock(float* out, int v, float freq, float shape, int numSamples)
+{
+    tMBSaw_setFreq(&saw[v], freq);
+    for (int i = 0; i < numSamples; ++i)
+    {
+        out[i] = tMBSaw_tick(&saw[v]) * 2.f;
+    }
+}
+
+void Oscillator::pulseBlock(float* out, int v, float freq, float shape, int numSamples)
+{
+    tMBPulse_setFreq(&pulse[v], freq);
+    tMBPulse_setWidth(&pulse[v], shape);
+    for (int i = 0; i < numSamples; ++i)
+    {
+        out[i] = tMBPulse_tick(&pulse[v]) * 2.f;
+    }
+}
+
+void Oscillator::sineBlock(float* out, int v, float freq, float shape, int numSamples)
+{
+    tCycle_setFreq(&sine[v], freq);
+    for (int i = 0; i < numSamples; ++i)
+    {
+        out[i] = tCycle_tick(&sine[v]);
+    }
+}
+
+void Oscillator::triBlock(float* out, int v, float freq, float shape, int numSamples)
+{
+    tMBTriangle_setFreq(&tri[v], freq);
+    tMBTriangle_setWidth(&tri[v], shape);
+    for (int i = 0; i < numSamples; ++i)
+    {
+        out[i] = tMBTriangle_tick(&tri[v]) * 2.f;
+    }
+}
+
+void Oscillator::userBlock(float* out, int v, float freq, float shape, int numSamples)
+{
+    if (waveSet == nullptr)
+    {
+        FloatVectorOperations::clear(out, numSamples);
+        return;
+    }
+    tWaveOscS* wave = &waveSet->wave[v];
+    tWaveOscS_setFreq(wave, freq);
+    tWaveOscS_setIndex(wave, shape);
+    for (int i = 0; i < numSamples; ++i)
+    {
+        out[i] = tWaveOscS_tick(wave);
+    }
+}
+
+void Oscillator::setWaveTables(File file)
+{
+    // The current set keeps playing until the new one is ready
+    if (file == waveTableFile) return;
+    waveTableFile = file;
+    waveTableLoader->request(this, file);
+}
+
+CachedWaveTables* Oscillator::loadWaveTables(const File& file, double sampleRate)
+{
+    WaveTableStore& store = waveTableLoader->getStore();
+    CachedWaveTables* tables = store.acquire(file, sampleRate);
+    if (tables == nullptr) tables = decodeWaveTables(file, sampleRate);
+    
+    if (tables != nullptr)
+    {
+        // Only listed for the shape menu once it's known to load
+        processor.waveTableFiles.addIfNotAlreadyThere(file);
+        loadedWaveTableFile = file;
+    }
+    else if (waveTableFile == file)
+    {
+        waveTableFile = loadedWaveTableFile;
+    }
+    return tables;
+}
+
+CachedWaveTables* Oscillator::decodeWaveTables(const File& file, double sampleRate)
+{
+    const String name = file.getFullPathName();
+    if (!processor.loadWaveTables(name, file).exists() || !processor.waveTables.contains(name))
+    {
+        return nullptr;
+    }
+    
+    // Made at the processor's rate, which prepareToPlay() may not have
+    // passed on yet
+    Array<tWaveTableS>& tables = processor.waveTables.getReference(name);
+    for (tWaveTableS& t : tables)
+    {
+        if (t->sampleRate != (float) sampleRate) tWaveTableS_setSampleRate(&t, (float) sampleRate);
+    }
+    
+    // The cache is written straight from them and mapped, or they're copied
+    // if it can't be. The processor's tables aren't needed after that
+    WaveTableStore& store = waveTableLoader->getStore();
+    CachedWaveTables* cached = nullptr;
+    if (CachedWaveTables::write(file, tables))
+    {
+        cached = store.acquire(file, sampleRate);
+    }
+    if (cached == nullptr)
+    {
+        cached = store.add(file, sampleRate, CachedWaveTables::copy(tables));
+    }
+    for (tWaveTableS& t : tables)
+    {
+        tWaveTableS_free(&t);
+    }
+    processor.waveTables.remove(name);
+    return cached;
+}
+
+WaveTableSet* Oscillator::buildWaveTableSet(const File& file, double sampleRate,
+                                            CachedWaveTables* tables)
+{
+    WaveTableSet* set = new WaveTableSet();
+    set->file = file;
+    set->sampleRate = sampleRate;
+    set->cached = tables;
+    waveTableLoader->setSampleRate(sampleRate);
+    LEAF& leaf = waveTableLoader->getLeaf();
+    for (int i = 0; i < NUM_STRINGS; ++i)
+    {
+        tWaveOscS_init(&set->wave[i], tables->getTables(), tables->size(), &leaf);
+    }
+    return set;
+}
+
+void Oscillator::publishWaveTableSet(WaveTableSet* set)
+{
+    if (set == nullptr) return;
+    // A set the audio thread never picked up was never used, so it can go now
+    freeWaveTableSet(pendingWaveSet.exchange(set, std::memory_order_acq_rel));
+}
+
+void Oscillator::collectRetiredWaveTableSets()
+{
+    retiredWaveSets.collect([this] (WaveTableSet* set) { freeWaveTableSet(set); });
+}
+
+void Oscillator::freeWaveTableSet(WaveTableSet* set)
+{
+    if (set == nullptr) return;
+    for (int i = 0; i < NUM_STRINGS; ++i)
+    {
+        tWaveOscS_free(&set->wave[i]);
+    }
+    waveTableLoader->getStore().release(set->cached);
+    delete set;
+}
+
+void Oscillator::retireWaveTableSet(WaveTableSet* set)
+{
+    retiredWaveSets.push(set);
+}
+
+//==============================================================================
+
+namespace
+{
+    // Followed by the source path, then for each table set its max frequency,
+    // number of mip levels and their sizes, then every level's samples in
+    // the same order, each level aligned to waveTableCacheAlign bytes
+    struct WaveTableCacheHeader
+    {
+        char magic[4];
+        uint32 version;
+        int64 sourceSize;
+        int64 sourceModified;
+        double sampleRate;
+        int32 numSets;
+        int32 pathLength;
+    };
+    
+    const char waveTableCacheMagic[4] = { 'E', 'W', 'T', 'C' };
+    const int64 waveTableCacheAlign = 64;
+    
+    // Bounds checked reads from a mapped cache file
+    struct WaveTableCacheReader
+    {
+        const char* data;
+        size_t size;
+        size_t position = 0;
+        
+        template <typename T>
+        bool read(T& value)
+        {
+            if (position + sizeof(T) > size) return false;
+            memcpy(&value, data + position, sizeof(T));
+            position += sizeof(T);
+            return true;
+        }
+        
+        const float* readSamples(int numSamples)
+        {
+            position = (position + waveTableCacheAlign - 1) & ~(size_t)(waveTableCacheAlign - 1);
+            if (position + sizeof(float) * numSamples > size) return nullptr;
+            const float* samples = reinterpret_cast<const float*>(data + position);
+            position += sizeof(float) * numSamples;
+            return samples;
+        }
+    };
+    
+    void padTo(OutputStream& out, int64 alignment)
+    {
+        const char zeros[waveTableCacheAlign] = {};
+        const int64 padding = (alignment - out.getPosition() % alignment) % alignment;
+        out.write(zeros, (size_t) padding);
+    }
+}
+
+File CachedWaveTables::getCacheFile(const File& file, double sampleRate)
+{
+    String key = file.getFullPathName() + "|"
+    + String(file.getLastModificationTime().toMilliseconds()) + "|" + String(sampleRate);
+    return File::getSpecialLocation(File::userApplicationDataDirectory)
+    .getChildFile("Electrosynth").getChildFile("WaveTableCache")
+    .getChildFile(String::toHexString(key.hashCode64()) + ".ewt");
+}
+
+std::unique_ptr<CachedWaveTables> CachedWaveTables::open(const File& file, double sampleRate)
+{
+    if (!file.existsAsFile()) return nullptr;
+    File cacheFile = getCacheFile(file, sampleRate);
+    if (!cacheFile.existsAsFile()) return nullptr;
+    
+    std::unique_ptr<CachedWaveTables> cached (new CachedWaveTables());
+    cached->map = std::make_unique<MemoryMappedFile>(cacheFile, MemoryMappedFile::readOnly);
+    if (cached->map->getData() == nullptr) return nullptr;
+    WaveTableCacheReader reader { static_cast<const char*>(cached->map->getData()),
+        cached->map->getSize() };
+    
+    // The key is hashed into the name, so check it in full before trusting it
+    WaveTableCacheHeader header;
+    if (!reader.read(header)
+        || memcmp(header.magic, waveTableCacheMagic, sizeof(header.magic)) != 0
+        || header.version != WAVETABLE_CACHE_VERSION
+        || header.sourceSize != file.getSize()
+        || header.sourceModified != file.getLastModificationTime().toMilliseconds()
+        || header.sampleRate != sampleRate
+        || header.numSets <= 0 || header.pathLength < 0
+        || reader.position + header.pathLength > reader.size)
+    {
+        return nullptr;
+    }
+    String path = String::fromUTF8(reader.data + reader.position, header.pathLength);
+    reader.position += header.pathLength;
+    if (path != file.getFullPathName()) return nullptr;
+    
+    Array<float> maxFreqs;
+    Array<Array<int>> sizes;
+    int numLevels = 0;
+    for (int s = 0; s < header.numSets; ++s)
+    {
+        float maxFreq;
+        int32 numTables;
+        if (!reader.read(maxFreq) || !reader.read(numTables) || numTables <= 0) return nullptr;
+        Array<int> setSizes;
+        for (int t = 0; t < numTables; ++t)
+        {
+            int32 size;
+            // Mip levels are looked up with a mask, so must be powers of two
+            if (!reader.read(size) || size <= 0 || !isPowerOfTwo(size)) return nullptr;
+            setSizes.add(size);
+        }
+        maxFreqs.add(maxFreq);
+        sizes.add(setSizes);
+        numLevels += numTables;
+    }
+    
+    cached->headers.calloc(header.numSets);
+    cached->sizes.malloc(numLevels);
+    cached->sizeMasks.malloc(numLevels);
+    cached->levels.malloc(numLevels);
+    int level = 0;
+    for (int s = 0; s < header.numSets; ++s)
+    {
+        const Array<int>& setSizes = sizes.getReference(s);
+        
+        _tWaveTableS* c = &cached->headers[s];
+        c->sampleRate = (float) sampleRate;
+        c->maxFreq = maxFreqs[s];
+        c->numTables = setSizes.size();
+        c->sizes = cached->sizes + level;
+        c->sizeMasks = cached->sizeMasks + level;
+        c->tables = cached->levels + level;
+        for (int t = 0; t < c->numTables; ++t, ++level)
+        {
+            const float* samples = reader.readSamples(setSizes[t]);
+            if (samples == nullptr) return nullptr;
+            c->sizes[t] = setSizes[t];
+            c->sizeMasks[t] = setSizes[t] - 1;
+            c->tables[t] = const_cast<float*>(samples);
+        }
+        c->baseTable = c->tables[0];
+        c->baseFreq = c->sampleRate / (float) c->sizes[0];
+        c->invBaseFreq = 1.f / c->baseFreq;
+        cached->tables.add(c);
+    }
+    return cached;
 }
 
-Oscillator::~Oscillator()
+bool CachedWaveTables::write(const File& file, const Array<tWaveTableS>& tables)
 {
-    for (int i = 0; i < processor.numInvParameterSkews; ++i)
-    {
-        leaf_free(&processor.leaf, (char*)sourceValues[i]);
-    }
+    if (tables.isEmpty() || !file.existsAsFile()) return false;
+    const double sampleRate = tables.getFirst()->sampleRate;
+    File cacheFile = getCacheFile(file, sampleRate);
+    if (!cacheFile.getParentDirectory().createDirectory().wasOk()) return false;
     
-    for (int i = 0; i < NUM_STRINGS; i++)
+    // Written beside the target and moved over it, so open() never sees a
+    // partial file
+    TemporaryFile temp (cacheFile);
     {
-        tMBSaw_free(&saw[i]);
-        tMBPulse_free(&pulse[i]);
-        tCycle_free(&sine[i]);
-        tMBTriangle_free(&tri[i]);
+        FileOutputStream out (temp.getFile());
+        if (!out.openedOk()) return false;
         
-        tMBSaw_free(&sawPaired[i]);
-        tMBPulse_free(&pulsePaired[i]);
-        tCycle_free(&sinePaired[i]);
-        tMBTriangle_free(&triPaired[i]);
+        const String path = file.getFullPathName();
+        WaveTableCacheHeader header;
+        memcpy(header.magic, waveTableCacheMagic, sizeof(header.magic));
+        header.version = WAVETABLE_CACHE_VERSION;
+        header.sourceSize = file.getSize();
+        header.sourceModified = file.getLastModificationTime().toMilliseconds();
+        header.sampleRate = sampleRate;
+        header.numSets = tables.size();
+        header.pathLength = (int32) path.getNumBytesAsUTF8();
+        out.write(&header, sizeof(header));
+        out.write(path.toRawUTF8(), (size_t) header.pathLength);
         
-        if (waveTableFile.exists())
+        for (tWaveTableS t : tables)
+        {
+            const int32 numTables = t->numTables;
+            out.write(&t->maxFreq, sizeof(float));
+            out.write(&numTables, sizeof(int32));
+            for (int i = 0; i < numTables; ++i)
+            {
+                const int32 size = t->sizes[i];
+                out.write(&size, sizeof(int32));
+            }
+        }
+        for (tWaveTableS t : tables)
         {
-            tWaveOscS_free(&wave[i]);
+            for (int i = 0; i < t->numTables; ++i)
+            {
+                padTo(out, waveTableCacheAlign);
+                out.write(t->tables[i], sizeof(float) * t->sizes[i]);
+            }
         }
+        out.flush();
+        if (out.getStatus().failed()) return false;
     }
-    DBG("Post exit: " + String(processor.leaf.allocCount) + " " + String(processor.leaf.freeCount));
+    return temp.overwriteTargetFileWithTemporary();
 }
 
-void Oscillator::prepareToPlay (double sampleRate, int samplesPerBlock)
+std::unique_ptr<CachedWaveTables> CachedWaveTables::copy(const Array<tWaveTableS>& tables)
 {
-    AudioComponent::prepareToPlay(sampleRate, samplesPerBlock);
-    for (int i = 0; i < NUM_STRINGS; i++)
+    if (tables.isEmpty()) return nullptr;
+    
+    int numLevels = 0;
+    size_t numSamples = 0;
+    for (tWaveTableS t : tables)
     {
-        tMBSaw_setSampleRate(&saw[i], sampleRate);
-        tMBPulse_setSampleRate(&pulse[i], sampleRate);
-        tCycle_setSampleRate(&sine[i], sampleRate);
-        tMBTriangle_setSampleRate(&tri[i], sampleRate);
-        
-        tMBSaw_setSampleRate(&sawPaired[i], sampleRate);
-        tMBPulse_setSampleRate(&pulsePaired[i], sampleRate);
-        tCycle_setSampleRate(&sinePaired[i], sampleRate);
-        tMBTriangle_setSampleRate(&triPaired[i], sampleRate);
+        numLevels += t->numTables;
+        for (int i = 0; i < t->numTables; ++i) numSamples += (size_t) t->sizes[i];
+    }
+    
+    std::unique_ptr<CachedWaveTables> cached (new CachedWaveTables());
+    cached->copiedSamples.malloc(numSamples);
+    cached->numCopiedBytes = (int64) (sizeof(float) * numSamples);
+    cached->headers.calloc(tables.size());
+    cached->sizes.malloc(numLevels);
+    cached->sizeMasks.malloc(numLevels);
+    cached->levels.malloc(numLevels);
+    int level = 0;
+    float* samples = cached->copiedSamples;
+    for (int s = 0; s < tables.size(); ++s)
+    {
+        tWaveTableS t = tables[s];
         
-        if (waveTableFile.exists())
+        _tWaveTableS* c = &cached->headers[s];
+        c->sampleRate = t->sampleRate;
+        c->maxFreq = t->maxFreq;
+        c->numTables = t->numTables;
+        c->sizes = cached->sizes + level;
+        c->sizeMasks = cached->sizeMasks + level;
+        c->tables = cached->levels + level;
+        for (int i = 0; i < c->numTables; ++i, ++level)
         {
-            tWaveOscS_setSampleRate(&wave[i], sampleRate);
+            memcpy(samples, t->tables[i], sizeof(float) * t->sizes[i]);
+            c->sizes[i] = t->sizes[i];
+            c->sizeMasks[i] = t->sizeMasks[i];
+            c->tables[i] = samples;
+            samples += t->sizes[i];
         }
+        c->baseTable = c->tables[0];
+        c->baseFreq = t->baseFreq;
+        c->invBaseFreq = t->invBaseFreq;
+        cached->tables.add(c);
     }
+    return cached;
 }
 
-void Oscillator::frame()
+//==============================================================================
+
+CachedWaveTables* WaveTableStore::acquire(const File& file, double sampleRate)
 {
-    sampleInBlock = 0;
-    enabled = afpEnabled == nullptr || *afpEnabled > 0 ||
-    processor.sourceMappingCounts[getName()] > 0;
+    const File cacheFile = CachedWaveTables::getCacheFile(file, sampleRate);
     
-    currentShapeSet = OscShapeSet(int(*afpShapeSet));
-    switch (currentShapeSet) {
-        case SawPulseOscShapeSet:
-            shapeTick = &Oscillator::sawSquareTick;
-            break;
-            
-        case SineTriOscShapeSet:
-            shapeTick = &Oscillator::sineTriTick;
-            break;
-            
-        case SawOscShapeSet:
-            shapeTick = &Oscillator::sawTick;
-            break;
-            
-        case PulseOscShapeSet:
-            shapeTick = &Oscillator::pulseTick;
-            break;
-            
-        case SineOscShapeSet:
-            shapeTick = &Oscillator::sineTick;
-            break;
-            
-        case TriOscShapeSet:
-            shapeTick = &Oscillator::triTick;
-            break;
-            
-        case UserOscShapeSet:
-            shapeTick = &Oscillator::userTick;
-            break;
-            
-        default:
-            shapeTick = &Oscillator::sawSquareTick;
-            break;
+    const ScopedLock sl(lock);
+    for (Entry* e : entries)
+    {
+        if (e->cacheFile == cacheFile)
+        {
+            e->numReferences++;
+            e->lastUsed = ++useCount;
+            return e->tables.get();
+        }
     }
+    
+    std::unique_ptr<CachedWaveTables> tables = CachedWaveTables::open(file, sampleRate);
+    if (tables == nullptr) return nullptr;
+    
+    Entry* e = entries.add(new Entry());
+    e->cacheFile = cacheFile;
+    e->tables = std::move(tables);
+    e->numReferences = 1;
+    e->lastUsed = ++useCount;
+    residentBytes += e->tables->getNumBytes();
+    evict();
+    return e->tables.get();
 }
 
-void Oscillator::tick(float output[][NUM_STRINGS])
+CachedWaveTables* WaveTableStore::add(const File& file, double sampleRate,
+                                      std::unique_ptr<CachedWaveTables> tables)
 {
-    if (loadingTables || !enabled) return;
+    if (tables == nullptr) return nullptr;
+    
+    const ScopedLock sl(lock);
+    Entry* e = entries.add(new Entry());
+    e->cacheFile = CachedWaveTables::getCacheFile(file, sampleRate);
+    e->tables = std::move(tables);
+    e->numReferences = 1;
+    e->lastUsed = ++useCount;
+    residentBytes += e->tables->getNumBytes();
+    evict();
+    return e->tables.get();
+}
 
-    for (int v = 0; v < processor.numVoicesActive; ++v)
+void WaveTableStore::release(CachedWaveTables* tables)
+{
+    if (tables == nullptr) return;
+    
+    const ScopedLock sl(lock);
+    for (int i = 0; i < entries.size(); ++i)
     {
-        if (!processor.voiceIsSounding[v]) continue;
+        Entry* e = entries.getUnchecked(i);
+        if (e->tables.get() != tables) continue;
         
-        float harm_pitch = quickParams[OscPitch][v]->tickNoSmoothing();
-        float fine = quickParams[OscFine][v]->tickNoSmoothing();
-        float freq = quickParams[OscFreq][v]->tickNoSmoothing();
-        float shape = quickParams[OscShape][v]->tickNoSmoothing();
-        float amp = quickParams[OscAmp][v]->tickNoSmoothing();
-       
-        amp = amp < 0.f ? 0.f : amp;
-        float note = processor.voiceNote[v];
-        if (isStepped_raw == nullptr || *isStepped_raw > 0)
-        {
-            harm_pitch = round(harm_pitch);
-        }
-        if (isHarmonic_raw == nullptr || *isHarmonic_raw > 0)
+        jassert(e->numReferences > 0);
+        e->numReferences--;
+        // A copy can't be reopened, so there's no point keeping it
+        if (e->numReferences == 0 && !e->tables->isMapped())
         {
-            note = harm_pitch >= 0 ? ftom(processor.tuner.mtof(note) * (harm_pitch + 1)) : ftom(processor.tuner.mtof(note) / abs((harm_pitch - 1)));
-            harm_pitch = 0;
+            residentBytes -= e->tables->getNumBytes();
+            entries.remove(i);
         }
-        //DBG(ftom(processor.tuner.mtof(note) / (harm - 1)));
-        //DBG(processor.tuner.mtof(note) / (harm - 1));
-        float finalFreq = processor.tuner.mtof(LEAF_clip(0, note + harm_pitch + fine*0.01f, 127)) + freq;
-        //DBG(note);
-        //freq = freq < 10.f ? 0.f : freq
-        
-        float sample = 0.0f;
-        
-        shape = LEAF_clip(0.f, shape, 1.f);
-        (this->*shapeTick)(sample, v, finalFreq, shape);
+        break;
+    }
+    evict();
+}
+
+void WaveTableStore::setBudget(int64 numBytes)
+{
+    budget.store(jmax(numBytes, int64(0)));
     
-        sample *= amp;
-        
-        float normSample = (sample + 1.f) * 0.5f;
-        sourceValues[0][v] = normSample;
-        for (int i = 1; i < processor.numInvParameterSkews; ++i)
+    const ScopedLock sl(lock);
+    evict();
+}
+
+void WaveTableStore::evict()
+{
+    // Tables in use are never evicted, so this can stay over budget
+    while (residentBytes.load() > budget.load())
+    {
+        int oldest = -1;
+        for (int i = 0; i < entries.size(); ++i)
         {
-            float invSkew = processor.quickInvParameterSkews[i];
-            sourceValues[i][v] = powf(normSample, invSkew);
+            Entry* e = entries.getUnchecked(i);
+            if (e->numReferences == 0
+                && (oldest < 0 || e->lastUsed < entries.getUnchecked(oldest)->lastUsed))
+            {
+                oldest = i;
+            }
         }
+        if (oldest < 0) break;
         
-        sample *= INV_NUM_OSCS;
-        
-        float f = filterSend->tickNoHooks();
-        
-        output[0][v] += sample*f * *afpEnabled;
-        output[1][v] += sample*(1.f-f) * *afpEnabled ;
+        const int64 numBytes = entries.getUnchecked(oldest)->tables->getNumBytes();
+        entries.remove(oldest);
+        residentBytes -= numBytes;
+        evictedBytes += numBytes;
     }
-    
-    sampleInBlock++;
 }
 
-void Oscillator::sawSquareTick(float& sample, int v, float freq, float shape)
+//==============================================================================
+
+WaveTableLoader::WaveTableLoader() :
+Thread("WaveTableLoader")
 {
-    tMBSaw_setFreq(&sawPaired[v], freq);
-    tMBPulse_setFreq(&pulsePaired[v], freq);
-    sample += tMBSaw_tick(&sawPaired[v]) * (1.0f - shape) * 2.f;
-    sample += tMBPulse_tick(&pulsePaired[v]) * shape * 2.f;
+    leafMemory.allocate(WAVETABLE_LOADER_POOL_SIZE, false);
+    // Nothing built here uses LEAF's random source
+    LEAF_init(&leaf, 44100.f, leafMemory, WAVETABLE_LOADER_POOL_SIZE, [] { return 0.f; });
+    startThread();
 }
 
-void Oscillator::sineTriTick(float& sample, int v, float freq, float shape)
+WaveTableLoader::~WaveTableLoader()
 {
-    tCycle_setFreq(&sinePaired[v], freq);
-    tMBTriangle_setFreq(&triPaired[v], freq);
-    sample += tCycle_tick(&sinePaired[v]) * (1.0f - shape);
-    sample += tMBTriangle_tick(&triPaired[v]) * shape * 2.f;;
+    signalThreadShouldExit();
+    notify();
+    stopThread(5000);
 }
 
-void Oscillator::sawTick(float& sample, int v, float freq, float shape)
+void WaveTableLoader::setSampleRate(double sampleRate)
 {
-    tMBSaw_setFreq(&saw[v], freq);
-    sample += tMBSaw_tick(&saw[v]) * 2.f;;
+    LEAF_setSampleRate(&leaf, (float) sampleRate);
 }
 
-void Oscillator::pulseTick(float& sample, int v, float freq, float shape)
+void WaveTableLoader::addOscillator(Oscillator* osc)
 {
-    tMBPulse_setFreq(&pulse[v], freq);
-    tMBPulse_setWidth(&pulse[v], shape);
-    sample += tMBPulse_tick(&pulse[v]) * 2.f;;
+    const ScopedLock sl(requestLock);
+    oscillators.addIfNotAlreadyThere(osc);
 }
 
-void Oscillator::sineTick(float& sample, int v, float freq, float shape)
+void WaveTableLoader::removeOscillator(Oscillator* osc)
 {
-    tCycle_setFreq(&sine[v], freq);
-    sample += tCycle_tick(&sine[v]);
+    {
+        const ScopedLock sl(requestLock);
+        for (int i = requests.size(); --i >= 0;)
+        {
+            if (requests.getReference(i).osc == osc) requests.remove(i);
+        }
+        oscillators.removeFirstMatchingValue(osc);
+    }
+    // Wait out a set that is still being built for osc
+    const ScopedLock jl(jobLock);
 }
 
-void Oscillator::triTick(float& sample, int v, float freq, float shape)
+bool WaveTableLoader::isRegistered(Oscillator* osc)
 {
-    tMBTriangle_setFreq(&tri[v], freq);
-    tMBTriangle_setWidth(&tri[v], shape);
-    sample += tMBTriangle_tick(&tri[v]) * 2.f;;
+    const ScopedLock sl(requestLock);
+    return oscillators.contains(osc);
 }
 
-void Oscillator::userTick(float& sample, int v, float freq, float shape)
+void WaveTableLoader::request(Oscillator* osc, const File& file)
 {
-    tWaveOscS_setFreq(&wave[v], freq);
-    tWaveOscS_setIndex(&wave[v], shape);
-    sample += tWaveOscS_tick(&wave[v]);
+    {
+        const ScopedLock sl(requestLock);
+        for (int i = requests.size(); --i >= 0;)
+        {
+            if (requests.getReference(i).osc == osc) requests.remove(i);
+        }
+        requests.add({ osc, file });
+    }
+    notify();
 }
 
-void Oscillator::setWaveTables(File file)
+void WaveTableLoader::run()
 {
-    loadingTables = true;
-    
-    File loaded = processor.loadWaveTables(file.getFullPathName(), file);
-    
-    if (loaded.exists() && loaded != waveTableFile)
+    while (!threadShouldExit())
     {
-        if (waveTableFile.exists())
+        Request job { nullptr, File() };
+        double sampleRate = 0.;
+        {
+            const ScopedLock sl(requestLock);
+            if (!requests.isEmpty())
+            {
+                job = requests.removeAndReturn(0);
+                sampleRate = job.osc->waveSampleRate.load();
+            }
+        }
+        
+        // Nothing can play before prepareToPlay() gives a rate, and it asks
+        // again then
+        CachedWaveTables* tables = nullptr;
+        if (job.osc != nullptr && sampleRate > 0.)
+        {
+            // Gives up if this thread is stopped first
+            const MessageManagerLock mml (this);
+            if (mml.lockWasGained() && isRegistered(job.osc))
+            {
+                tables = job.osc->loadWaveTables(job.file, sampleRate);
+            }
+        }
+        
         {
-            for (int i = 0; i < NUM_STRINGS; ++i)
+            const ScopedLock jl(jobLock);
+            
+            if (tables != nullptr)
             {
-                tWaveOscS_free(&wave[i]);
+                // The oscillator may have gone while the message thread ran
+                if (isRegistered(job.osc))
+                {
+                    job.osc->publishWaveTableSet(job.osc->buildWaveTableSet(job.file, sampleRate, tables));
+                }
+                else store.release(tables);
             }
+            
+            const ScopedLock sl(requestLock);
+            for (auto* osc : oscillators) osc->collectRetiredWaveTableSets();
         }
-        waveTableFile = loaded;
         
-        for (int i = 0; i < NUM_STRINGS; ++i)
+        bool idle;
         {
-            Array<tWaveTableS>& tables = processor.waveTables.getReference(waveTableFile.getFullPathName());
-            tWaveOscS_init(&wave[i], tables.getRawDataPointer(), tables.size(), &processor.leaf);
+            const ScopedLock sl(requestLock);
+            idle = requests.isEmpty();
         }
+        // Retired sets only need collecting now and then
+        if (idle) wait(100);
     }
-    
-    loadingTables = false;
 }
 
 //==============================================================================
@@ -273,6 +1364,9 @@ LowFreqOscillator::LowFreqOscillator(const String& n, ElectroAudioProcessor& p,
 AudioComponent(n, p, vts, cLowFreqParams, false),
 MappingSourceModel(p, n, true, true, Colours::chartreuse)
 {
+    params.setRate(LowFreqRate, ControlRate);
+    params.setRate(LowFreqShape, ControlRate);
+    
     for (int i = 0; i < p.numInvParameterSkews; ++i)
     {
         sourceValues[i] = (float*) leaf_alloc(&p.leaf, sizeof(float) * NUM_STRINGS);
@@ -280,19 +1374,19 @@ MappingSourceModel(p, n, true, true, Colours::chartreuse)
     }
     
     sync = vts.getParameter(n + " Sync");
+    afpTempoSync = vts.getRawParameterValue(n + " TempoSync");
+    afpDivision = vts.getRawParameterValue(n + " Division");
+    afpGlobal = vts.getRawParameterValue(n + " Global");
+    globalVoices.add(0);
     
-    for (int i = 0; i < NUM_STRINGS; i++)
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
     {
-        tMBSaw_init(&saw[i], &processor.leaf);
-        tMBPulse_init(&pulse[i], &processor.leaf);
-        tCycle_init(&sine[i], &processor.leaf);
-        tMBTriangle_init(&tri[i], &processor.leaf);
-        
-        tMBSaw_init(&sawPaired[i], &processor.leaf);
-        tMBPulse_init(&pulsePaired[i], &processor.leaf);
-        tCycle_init(&sinePaired[i], &processor.leaf);
-        tMBTriangle_init(&triPaired[i], &processor.leaf);
+        shapes[v] = 0.f;
+        current[v] = 0.5f;
+        target[v] = 0.5f;
+        step[v] = 0.f;
     }
+    shapeTick = &LowFreqOscillator::sineTriTick;
     
     phaseReset = 0.0f;
     
@@ -305,43 +1399,21 @@ LowFreqOscillator::~LowFreqOscillator()
     {
         leaf_free(&processor.leaf, (char*)sourceValues[i]);
     }
-    
-    for (int i = 0; i < NUM_STRINGS; i++)
-    {
-        tMBSaw_free(&saw[i]);
-        tMBPulse_free(&pulse[i]);
-        tCycle_free(&sine[i]);
-        tMBTriangle_free(&tri[i]);
-        
-        tMBSaw_free(&sawPaired[i]);
-        tMBPulse_free(&pulsePaired[i]);
-        tCycle_free(&sinePaired[i]);
-        tMBTriangle_free(&triPaired[i]);
-    }
 }
 
 void LowFreqOscillator::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     AudioComponent::prepareToPlay(sampleRate, samplesPerBlock);
-    for (int i = 0; i < NUM_STRINGS; i++)
-    {
-        tMBSaw_setSampleRate(&saw[i], sampleRate);
-        tMBPulse_setSampleRate(&pulse[i], sampleRate);
-        tCycle_setSampleRate(&sine[i], sampleRate);
-        tMBTriangle_setSampleRate(&tri[i], sampleRate);
-        
-        tMBSaw_setSampleRate(&sawPaired[i], sampleRate);
-        tMBPulse_setSampleRate(&pulsePaired[i], sampleRate);
-        tCycle_setSampleRate(&sinePaired[i], sampleRate);
-        tMBTriangle_setSampleRate(&triPaired[i], sampleRate);
-    }
+    bank.setSampleRate(sampleRate);
 }
 
 void LowFreqOscillator::frame()
 {
-    sampleInBlock = 0;
+    AudioComponent::frame();
     // only enabled if it's actually being used as a source
-    enabled = processor.sourceMappingCounts[getName()] > 0;
+    enabled = isMapped();
+    // Per voice unless the layout has the parameter
+    global = afpGlobal != nullptr && *afpGlobal > 0.5f;
     currentShapeSet = LFOShapeSet(int(*afpShapeSet));
     switch (currentShapeSet) {
         case SineTriLFOShapeSet:
@@ -372,92 +1444,198 @@ void LowFreqOscillator::frame()
             shapeTick = &LowFreqOscillator::sineTriTick;
             break;
     }
+    
+    // The parameters restart their grid with the block, so an interval cut
+    // short is taken back. The ramps already stand where the phase does
+    if (controlCountdown > 0)
+    {
+        bank.advance(-controlCountdown);
+        for (int v = 0; v < OSC_BANK_LANES; ++v)
+        {
+            target[v] = current[v];
+        }
+        controlCountdown = 0;
+    }
+    controlInterval = params.getControlInterval();
+    invControlInterval = 1.f / controlInterval;
+    
+    syncToHost();
+}
+
+void LowFreqOscillator::syncToHost()
+{
+    // Quarter notes in one cycle of each division
+    static const double divisionBeats[LFODivisionNil] =
+    {
+        16., 8., 4.,
+        3., 2., 4. / 3.,
+        1.5, 1., 2. / 3.,
+        0.75, 0.5, 1. / 3.,
+        0.375, 0.25, 1. / 6.,
+        0.125
+    };
+    
+    // Without both parameters in the layout there's nothing to lock to, so
+    // the LFO runs free
+    tempoSynced = afpTempoSync != nullptr && afpDivision != nullptr && *afpTempoSync > 0.5f;
+    if (!tempoSynced) return;
+    
+    Optional<AudioPlayHead::PositionInfo> position;
+    if (AudioPlayHead* playHead = processor.getPlayHead())
+    {
+        position = playHead->getPosition();
+    }
+    
+    const int division = jlimit(0, LFODivisionNil - 1, int(*afpDivision));
+    const double beats = divisionBeats[division];
+    const double bpm = position ? position->getBpm().orFallback(120.) : 120.;
+    syncedRate = float(bpm / (60. * beats));
+    
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        bank.setFreq(v, syncedRate);
+    }
+    
+    // Stopped, or with no position to go by, the LFO keeps running at the
+    // tempo from wherever it was
+    if (!position || !position->getIsPlaying()) return;
+    const Optional<double> ppqPosition = position->getPpqPosition();
+    if (!ppqPosition) return;
+    
+    const double cycles = *ppqPosition / beats + phaseReset;
+    const float phase = float(cycles - std::floor(cycles));
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        bank.setPhase(v, phase);
+    }
+    // The first tick of the block starts its ramp from exactly this phase
+    renderTargets();
 }
 
 void LowFreqOscillator::tick()
 {
     if (!enabled) return;
 //    float a = sampleInBlock * invBlockSize;
+    params.tick();
     
-    for (int v = 0; v < processor.numVoicesActive; v++)
+    ActiveVoices& voices = renderedVoices();
+    if (controlCountdown == 0)
     {
-        float rate = quickParams[LowFreqRate][v]->tickNoSmoothing();
-        float shape = quickParams[LowFreqShape][v]->tickNoSmoothing();
-        // Even though our oscs can handle negative frequency I think allowing the rate to
-        // go negative would be confusing behavior
-        rate = rate < 0.f ? 0.f : rate;
-        shape = LEAF_clip(0.f, shape, 1.f);
-        
-        float sample = 0;
-        (this->*shapeTick)(sample, v, rate, shape);
-        
-        float normSample = (sample + 1.f) * 0.5f;
-        sourceValues[0][v] = normSample;
-        for (int i = 1; i < processor.numInvParameterSkews; ++i)
+        controlCountdown = controlInterval;
+        for (int v : voices)
+        {
+            updateVoice(v);
+            current[v] = target[v];
+        }
+        bank.advance(controlInterval);
+        renderTargets();
+        for (int v : voices)
         {
-            float invSkew = processor.quickInvParameterSkews[i];
-            sourceValues[i][v] = powf(normSample, invSkew);
+            step[v] = (target[v] - current[v]) * invControlInterval;
         }
     }
+    --controlCountdown;
+    
+    for (int v : voices)
+    {
+        sourceValues[0][v] = current[v];
+        current[v] += step[v];
+    }
+    if (global)
+    {
+        computeSkews(1);
+        broadcast(NUM_STRINGS);
+    }
+    else computeSkews(processor.numVoicesActive);
     sampleInBlock++;
 }
 
-void LowFreqOscillator::sawSquareTick(float& sample, int v, float rate, float shape)
+ActiveVoices& LowFreqOscillator::renderedVoices()
 {
-    tMBSaw_setFreq(&sawPaired[v], rate);
-    tMBPulse_setFreq(&pulsePaired[v], rate);
-    sample += tMBSaw_tick(&sawPaired[v]) * (1.0f - shape) * 2.f;;
-    sample += tMBPulse_tick(&pulsePaired[v]) * shape * 2.f;;
+    return global ? globalVoices : state.activeVoices;
 }
 
-void LowFreqOscillator::sineTriTick(float& sample, int v, float rate, float shape)
+void LowFreqOscillator::updateVoice(int v)
 {
-    tCycle_setFreq(&sinePaired[v], rate);
-    tMBTriangle_setFreq(&triPaired[v], rate);
-    sample += tCycle_tick(&sinePaired[v]) * (1.0f - shape);
-    sample += tMBTriangle_tick(&triPaired[v]) * shape * 2.f;;
+    float rate = tempoSynced ? syncedRate : getParameterValue(LowFreqRate, v);
+    float shape = getParameterValue(LowFreqShape, v);
+    // Even though our oscs can handle negative frequency I think allowing the rate to
+    // go negative would be confusing behavior
+    rate = rate < 0.f ? 0.f : rate;
+    shape = LEAF_clip(0.f, shape, 1.f);
+    
+    bank.setFreq(v, rate);
+    shapes[v] = shape;
 }
 
-void LowFreqOscillator::sineTick(float& sample, int v, float freq, float shape)
+void LowFreqOscillator::renderTargets()
 {
-    tCycle_setFreq(&sine[v], freq);
-    sample += tCycle_tick(&sine[v]);
+    // The bank's PolyBLEP only reaches one sample either side of an edge,
+    // so at control rate the shapes are as good as naive
+    (this->*shapeTick)(samplesA);
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        target[v] = (samplesA[v] + 1.f) * 0.5f;
+    }
 }
 
-void LowFreqOscillator::triTick(float& sample, int v, float freq, float shape)
+// Starts voice v from phase on the next sample, then ramps it to the grid
+// like the others. Other lanes render to the targets they already have
+void LowFreqOscillator::resyncVoice(int v, float phase)
 {
-    tMBTriangle_setFreq(&tri[v], freq);
-    tMBTriangle_setWidth(&tri[v], shape);
-    sample += tMBTriangle_tick(&tri[v]) * 2.f;;
+    bank.setPhase(v, phase);
+    renderTargets();
+    current[v] = target[v];
+    
+    bank.setPhase(v, phase + bank.getIncrement(v) * controlCountdown);
+    renderTargets();
+    step[v] = controlCountdown > 0 ? (target[v] - current[v]) / controlCountdown : 0.f;
 }
 
-void LowFreqOscillator::sawTick(float& sample, int v, float freq, float shape)
+void LowFreqOscillator::sawSquareTick(float* samples)
 {
-    tMBSaw_setFreq(&saw[v], freq);
-    sample += tMBSaw_tick(&saw[v]) * 2.f;;
+    bank.renderSawPulse(samples, shapes);
 }
 
-void LowFreqOscillator::pulseTick(float& sample, int v, float freq, float shape)
+void LowFreqOscillator::sineTriTick(float* samples)
 {
-    tMBPulse_setFreq(&pulse[v], freq);
-    tMBPulse_setWidth(&pulse[v], shape);
-    sample += tMBPulse_tick(&pulse[v]) * 2.f;;
+    bank.renderSineTri(samples, shapes);
+}
+
+void LowFreqOscillator::sineTick(float* samples)
+{
+    bank.renderSine(samples);
+}
+
+void LowFreqOscillator::triTick(float* samples)
+{
+    bank.renderTriangle(samples, shapes);
+}
+
+void LowFreqOscillator::sawTick(float* samples)
+{
+    bank.renderSaw(samples);
+}
+
+void LowFreqOscillator::pulseTick(float* samples)
+{
+    bank.renderPulse(samples, shapes);
 }
 
 void LowFreqOscillator::noteOn(int voice, float velocity)
 {
-    if (sync->getValue() > 0)
+    // A global LFO is the first lane whichever voice starts
+    if (global) voice = 0;
+    
+    // Free running voices pick up where their phase is now. Their ramp is
+    // stale if they were idle. The host's beat wins over a note-on reset
+    float phase = bank.getPhase(voice) - bank.getIncrement(voice) * controlCountdown;
+    if (sync->getValue() > 0 && !tempoSynced)
     {
-        tMBSaw_setPhase(&saw[voice], phaseReset);
-        tMBPulse_setPhase(&pulse[voice], phaseReset);
-        tCycle_setPhase(&sine[voice], phaseReset);
-        tMBTriangle_setPhase(&tri[voice], phaseReset);
-        
-        tMBSaw_setPhase(&sawPaired[voice], phaseReset);
-        tMBPulse_setPhase(&pulsePaired[voice], phaseReset);
-        tCycle_setPhase(&sinePaired[voice], phaseReset);
-        tMBTriangle_setPhase(&triPaired[voice], phaseReset);
+        phase = phaseReset;
     }
+    updateVoice(voice);
+    resyncVoice(voice, phase);
 }
 
 
@@ -467,6 +1645,8 @@ NoiseGenerator::NoiseGenerator(const String& n, ElectroAudioProcessor& p, AudioP
 AudioComponent(n, p, vts, cNoiseParams, true),
 MappingSourceModel(p, n, true, true, Colours::darkorange)
 {
+    params.setRate(NoiseColor, ControlRate);
+    
     for (int i = 0; i < p.numInvParameterSkews; ++i)
     {
         sourceValues[i] = (float*) leaf_alloc(&p.leaf, sizeof(float) * NUM_STRINGS);
@@ -475,8 +1655,14 @@ MappingSourceModel(p, n, true, true, Colours::darkorange)
     
     for (int i = 0; i < NUM_STRINGS; i++)
     {
-        tNoise_init(&noise[i], WhiteNoise, &processor.leaf);
-        tSVF_init(&bandpass[i], SVFTypeBandpass, 2000.f, 0.7f, &processor.leaf);
+        lastColor[i] = -1.f;
+    }
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        setBandpassFreq(v, 2000.f);
+        bandpassIc1[v] = 0.f;
+        bandpassIc2[v] = 0.f;
+        noiseSamples[v] = 0.f;
     }
     
     filterSend = std::make_unique<SmoothedParameter>(p, vts, n + " FilterSend");
@@ -490,28 +1676,38 @@ NoiseGenerator::~NoiseGenerator()
     {
         leaf_free(&processor.leaf, (char*)sourceValues[i]);
     }
-    
-    for (int i = 0; i < NUM_STRINGS; i++)
-    {
-        tNoise_free(&noise[i]);
-        tSVF_free(&bandpass[i]);
-    }
 }
 
 void NoiseGenerator::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     AudioComponent::prepareToPlay(sampleRate, samplesPerBlock);
-    for (int i = 0; i < NUM_STRINGS; i++)
+    noise.setSeed(seed);
+    invSampleRate = 1.f / sampleRate;
+    // Every voice works its coefficients out again on the next control tick
+    for (int v = 0; v < OSC_BANK_LANES; ++v)
+    {
+        setBandpassFreq(v, 2000.f);
+    }
+    for (int v = 0; v < NUM_STRINGS; ++v)
     {
-        tSVF_setSampleRate(&bandpass[i], sampleRate);
+        lastColor[v] = -1.f;
     }
+    filterSendBlock.allocate(samplesPerBlock, true);
 }
 
 void NoiseGenerator::frame()
 {
-    sampleInBlock = 0;
+    AudioComponent::frame();
     enabled = afpEnabled == nullptr || *afpEnabled > 0 ||
-    processor.sourceMappingCounts[getName()] > 0;
+    isMapped();
+    // Color is read on the same grid as the control rate parameters
+    controlCountdown = 0;
+    
+    if (enabled)
+    {
+        filterSend->advance(samplesInLastBlock);
+        filterSend->tickBlockNoHooks(filterSendBlock, currentBlockSize);
+    }
     
 //    currentShapeSet = LFOShapeSet(int(*afpShapeSet));
 //    switch (currentShapeSet) {
@@ -545,34 +1741,56 @@ void NoiseGenerator::frame()
 //    }
 }
 
+void NoiseGenerator::setBandpassFreq(int v, float freq)
+{
+    // Q of 0.7, as the filter was set up with
+    const float k = 1.f / 0.7f;
+    const float g = std::tan(MathConstants<float>::pi * freq * invSampleRate);
+    bandpassA1[v] = 1.f / (1.f + g * (g + k));
+    bandpassA2[v] = g * bandpassA1[v];
+    bandpassA3[v] = g * bandpassA2[v];
+}
+
 void NoiseGenerator::tick(float output[][NUM_STRINGS])
 {
     if (!enabled) return;
     //    float a = sampleInBlock * invBlockSize;
+    params.tick();
+    
+    float f = sampleInBlock < currentBlockSize ?
+    filterSendBlock[sampleInBlock] : filterSend->tickNoHooks();
     
-    for (int v = 0; v < processor.numVoicesActive; v++)
+    if (controlCountdown == 0)
     {
-        float color = quickParams[NoiseColor][v]->tickNoSmoothing();
-        float amp = quickParams[NoiseAmp][v]->tickNoSmoothing();
-        color = color < 0.f ? 0.f : color;
-        color = mtof(color*100.f + 24.f);
-        amp = amp < 0.f ? 0.f : amp;
+        controlCountdown = params.getControlInterval();
+        for (int v : state.activeVoices)
+        {
+            float color = getParameterValue(NoiseColor, v);
+            color = color < 0.f ? 0.f : color;
+            if (color == lastColor[v]) continue;
+            lastColor[v] = color;
+            setBandpassFreq(v, mtof(color*100.f + 24.f));
+        }
+    }
+    --controlCountdown;
     
-        tSVF_setFreq(&bandpass[v], color);
-        float sample = tSVF_tick(&bandpass[v], tNoise_tick(&noise[v])) * amp;
+    // Idle lanes run too, so each voice's stream doesn't depend on which
+    // others were playing
+    noise.render(noiseSamples);
+    bandpassLanes(bandpassIc1, bandpassIc2, bandpassA1, bandpassA2, bandpassA3, noiseSamples);
+    
+    for (int v : state.activeVoices)
+    {
+        float amp = getParameterValue(NoiseAmp, v);
+        amp = amp < 0.f ? 0.f : amp;
+        float sample = noiseSamples[v] * amp;
         
         float normSample = (sample + 1.f) * 0.5f;
         sourceValues[0][v] = normSample;
-        for (int i = 1; i < processor.numInvParameterSkews; ++i)
-        {
-            float invSkew = processor.quickInvParameterSkews[i];
-            sourceValues[i][v] = powf(normSample, invSkew);
-        }
-        
-        float f = filterSend->tickNoHooks();
         
         output[0][v] += sample*f * *afpEnabled;
         output[1][v] += sample*(1.f-f) * *afpEnabled ;
     }
+    computeSkews(processor.numVoicesActive);
     sampleInBlock++;
 }
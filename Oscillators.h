@@ -12,8 +12,283 @@
 
 #include "../Constants.h"
 #include "Utilities.h"
+#include "OscillatorKernels.h"
 
 class ElectroAudioProcessor;
+class Oscillator;
+
+// Unison copies of every voice, each copy taking a further OSC_BANK_LANES
+#define OSC_MAX_UNISON 8
+#define OSC_BANK_MAX_LANES (OSC_BANK_LANES * OSC_MAX_UNISON)
+
+// High quality runs the MB oscillators this many times faster and decimates
+#define OSC_HIGH_QUALITY_RATIO 2
+// Samples to fade out, and then back in, around a quality or unison change
+#define OSC_QUALITY_FADE_LENGTH 64
+
+typedef enum
+{
+    EcoOscQuality = 0,
+    StandardOscQuality,
+    HighOscQuality,
+    OscQualityNil
+} OscQuality;
+
+// Note lengths a tempo synced LFO can take for one cycle
+typedef enum
+{
+    FourBarsLFODivision = 0,
+    TwoBarsLFODivision,
+    WholeLFODivision,
+    HalfDottedLFODivision,
+    HalfLFODivision,
+    HalfTripletLFODivision,
+    QuarterDottedLFODivision,
+    QuarterLFODivision,
+    QuarterTripletLFODivision,
+    EighthDottedLFODivision,
+    EighthLFODivision,
+    EighthTripletLFODivision,
+    SixteenthDottedLFODivision,
+    SixteenthLFODivision,
+    SixteenthTripletLFODivision,
+    ThirtySecondLFODivision,
+    LFODivisionNil
+} LFODivision;
+
+//==============================================================================
+
+// Naive phase accumulators for every voice, with PolyBLEP corrections on the
+// saw and pulse and PolyBLAMP on the triangle's corners, laid out as lanes
+// so all voices are rendered in one pass.
+// Each kernel is compiled for SSE2, AVX2 and AVX-512 where the compiler
+// allows it, and the widest one the CPU supports is picked at startup.
+// Outputs are in [-1, 1]. Render as many shapes as needed for the current
+// phases, then advance() once per sample. Only the first getNumLanes()
+// lanes are rendered, and every array passed in must be at least that long
+class OscillatorBank
+{
+public:
+    OscillatorBank();
+    
+    void setSampleRate(float sampleRate);
+    void setFreq(int v, float freq) { inc[v] = freq * invSampleRate; }
+    void setPhase(int v, float p) { phase[v] = p - std::floor(p); }
+    float getPhase(int v) { return phase[v]; }
+    float getIncrement(int v) { return inc[v]; }
+    // A multiple of OSC_BANK_LANES, up to OSC_BANK_MAX_LANES
+    void setNumLanes(int n) { numLanes = n; }
+    int getNumLanes() { return numLanes; }
+    
+    void renderSaw(float* out);
+    void renderPulse(float* out, const float* width);
+    void renderTriangle(float* out, const float* width);
+    void renderSine(float* out);
+    // Crossfades between the two shapes of a pair from the one phase, mix
+    // 0 being saw or sine and 1 square or triangle
+    void renderSawPulse(float* out, const float* mix);
+    void renderSineTri(float* out, const float* mix);
+    void advance();
+    // Moves every lane on by numSamples at the current frequencies, or
+    // back when negative
+    void advance(int numSamples);
+    
+    struct Kernels
+    {
+        void (*saw)(const float* phase, const float* inc, float* out, int n);
+        void (*pulse)(const float* phase, const float* inc, const float* width, float* out, int n);
+        void (*triangle)(const float* phase, const float* inc, const float* width, float* out, int n);
+        void (*sine)(const float* phase, float* out, int n);
+        void (*sawPulse)(const float* phase, const float* inc, const float* mix, float* out, int n);
+        void (*sineTri)(const float* phase, const float* inc, const float* mix, float* out, int n);
+        void (*advance)(float* phase, const float* inc, int n);
+    };
+    
+private:
+    alignas(64) float phase[OSC_BANK_MAX_LANES];
+    alignas(64) float inc[OSC_BANK_MAX_LANES];
+    float invSampleRate = 1.f / 44100.f;
+    int numLanes = OSC_BANK_LANES;
+    const Kernels& kernels;
+};
+
+//==============================================================================
+
+#define DEFAULT_NOISE_SEED 0x2545F491u
+
+// Uniform white noise in [-1, 1) for every lane, from an xorshift32
+// generator per lane, all stepped in one pass. Lanes are seeded from a
+// hash of the seed and their index, so their streams are independent, and
+// the same seed always gives the same streams whichever voices are playing
+class NoiseBank
+{
+public:
+    NoiseBank(uint32 seed = DEFAULT_NOISE_SEED) { setSeed(seed); }
+    
+    void setSeed(uint32 seed);
+    void render(float* out);
+    
+private:
+    alignas(64) uint32 state[OSC_BANK_LANES];
+};
+
+//==============================================================================
+
+// Bump whenever the cache layout or the way LEAF builds tables changes
+#define WAVETABLE_CACHE_VERSION 1
+#define DEFAULT_WAVETABLE_BUDGET (int64(64) << 20)
+// Size of the loader's own LEAF pool, which every wavetable oscillator is
+// allocated from. Tables are decoded by the processor and live in the store
+#define WAVETABLE_LOADER_POOL_SIZE (size_t(4) << 20)
+
+// Band-limited tables for one wavetable file, memory mapped read-only from a
+// cache written the first time that file was built at this sample rate, so
+// reopening it needs no decoding or filtering. When the cache can't be
+// written they are copied into memory instead. Either way the tables point
+// into memory this owns, so they must never be freed or resampled through
+// LEAF
+class CachedWaveTables
+{
+public:
+    // Returns nullptr unless there is an up to date cache for file at sampleRate
+    static std::unique_ptr<CachedWaveTables> open(const File& file, double sampleRate);
+    // Caches tables as tWaveTableS_init built them from file
+    static bool write(const File& file, const Array<tWaveTableS>& tables);
+    // Copies tables into memory, for when they couldn't be written
+    static std::unique_ptr<CachedWaveTables> copy(const Array<tWaveTableS>& tables);
+    static File getCacheFile(const File& file, double sampleRate);
+    
+    tWaveTableS* getTables() { return tables.getRawDataPointer(); }
+    int size() { return tables.size(); }
+    bool isMapped() { return map != nullptr; }
+    int64 getNumBytes() { return map != nullptr ? (int64) map->getSize() : numCopiedBytes; }
+    
+private:
+    CachedWaveTables() = default;
+    
+    std::unique_ptr<MemoryMappedFile> map;
+    HeapBlock<float> copiedSamples;
+    int64 numCopiedBytes = 0;
+    // LEAF table headers filled in by hand rather than taken from a LEAF
+    // pool, so they can outlive the processor that first opened them
+    HeapBlock<_tWaveTableS> headers;
+    HeapBlock<int> sizes;
+    HeapBlock<int> sizeMasks;
+    HeapBlock<float*> levels;
+    Array<tWaveTableS> tables;
+};
+
+// Wavetables shared by every oscillator, counted by the sets using them.
+// Unused mapped tables stay mapped so going back to a file is instant, until
+// resident bytes pass the budget and the least recently used are unmapped.
+// Tables copied into memory count against the budget too, but are freed as
+// soon as nothing uses them, since they couldn't be reopened
+class WaveTableStore
+{
+public:
+    WaveTableStore() = default;
+    
+    // Adds a reference to the tables for file at sampleRate, mapping them if
+    // needed. Returns nullptr if they haven't been cached
+    CachedWaveTables* acquire(const File& file, double sampleRate);
+    // Takes tables copied into memory for file at sampleRate, returning them
+    // with one reference
+    CachedWaveTables* add(const File& file, double sampleRate,
+                          std::unique_ptr<CachedWaveTables> tables);
+    void release(CachedWaveTables* tables);
+    
+    void setBudget(int64 numBytes);
+    int64 getBudget() { return budget.load(); }
+    // Bytes mapped or copied right now, and unmapped to stay within budget
+    // so far
+    int64 getResidentBytes() { return residentBytes.load(); }
+    int64 getEvictedBytes() { return evictedBytes.load(); }
+    
+private:
+    struct Entry
+    {
+        File cacheFile;
+        std::unique_ptr<CachedWaveTables> tables;
+        int numReferences = 0;
+        uint32 lastUsed = 0;
+    };
+    
+    void evict();
+    
+    CriticalSection lock;
+    OwnedArray<Entry> entries;
+    uint32 useCount = 0;
+    
+    std::atomic<int64> budget { DEFAULT_WAVETABLE_BUDGET };
+    std::atomic<int64> residentBytes { 0 };
+    std::atomic<int64> evictedBytes { 0 };
+    
+    JUCE_DECLARE_NON_COPYABLE (WaveTableStore)
+};
+
+// Wavetable oscillators for every voice, fully initialised before the audio
+// thread sees them. Once published only the audio thread touches a set,
+// until it is retired and the loader frees it
+struct WaveTableSet
+{
+    File file;
+    double sampleRate = 0.;
+    tWaveOscS wave[NUM_STRINGS];
+    // Held from the store
+    CachedWaveTables* cached = nullptr;
+    WaveTableSet* nextRetired = nullptr;
+};
+
+// Loads wavetable files and builds WaveTableSets in the background, then
+// hands them to their oscillator. Shared by every oscillator so files are
+// built one at a time. Files are decoded through the processor, with the
+// message thread held off since it shares the processor's LEAF. Sets come
+// from the loader's own LEAF pool
+class WaveTableLoader : private Thread
+{
+public:
+    WaveTableLoader();
+    ~WaveTableLoader() override;
+    
+    void addOscillator(Oscillator* osc);
+    // Blocks until any set being built for osc is finished
+    void removeOscillator(Oscillator* osc);
+    // Replaces any request for osc that hasn't started yet
+    void request(Oscillator* osc, const File& file);
+    
+    WaveTableStore& getStore() { return store; }
+    // Sets come from the loader's pool, so are only freed with this held
+    const CriticalSection& getJobLock() { return jobLock; }
+    
+    // With the job lock held. Oscillators are made at the rate set last
+    LEAF& getLeaf() { return leaf; }
+    void setSampleRate(double sampleRate);
+    
+private:
+    void run() override;
+    bool isRegistered(Oscillator* osc);
+    
+    struct Request
+    {
+        Oscillator* osc;
+        File file;
+    };
+    
+    // Guards requests and oscillators
+    CriticalSection requestLock;
+    Array<Request> requests;
+    Array<Oscillator*> oscillators;
+    // Held while a set is built and published or sets are freed. Never
+    // while holding the message thread, which takes it to remove oscillators
+    CriticalSection jobLock;
+    
+    WaveTableStore store;
+    
+    HeapBlock<char> leafMemory;
+    LEAF leaf;
+    
+    JUCE_DECLARE_NON_COPYABLE (WaveTableLoader)
+};
 
 //==============================================================================
 
@@ -30,13 +305,66 @@ public:
     void frame();
     void tick(float output[][NUM_STRINGS]);
     
+    // Renders numSamples of every voice at once from the current sample,
+    // adding into per voice F1 and F2 send buffers, and moves on as far as
+    // that many calls to tick() would. For the processor to use over spans
+    // with no MIDI events, since the voices and their notes are taken as
+    // fixed for the whole span. Only valid when canProcessBlock(), since
+    // parameters are held too and nothing may read this as a source per
+    // sample
+    bool canProcessBlock();
+    void processBlock(float* const f1Sends[NUM_STRINGS], float* const f2Sends[NUM_STRINGS],
+                      int numSamples);
+    
     //==============================================================================
     void setWaveTables(File file);
     File& getWaveTableFile() { return waveTableFile; }
     void setMtoF(float mn);
     OscShapeSet getCurrentShapeSet() { return currentShapeSet; }
+    OscQuality getCurrentQuality() { return quality; }
+    int getUnison() { return unison; }
     
 private:
+    friend class WaveTableLoader;
+    
+    // Loader thread only, with the message thread held off. Finds the tables
+    // for file at sampleRate in the store, or decodes them with the
+    // processor and adds them, returning them with one reference. Lists the
+    // file for the shape menu if it loads, and lets it be asked for again
+    // if it doesn't
+    CachedWaveTables* loadWaveTables(const File& file, double sampleRate);
+    CachedWaveTables* decodeWaveTables(const File& file, double sampleRate);
+    // Loader thread only
+    WaveTableSet* buildWaveTableSet(const File& file, double sampleRate, CachedWaveTables* tables);
+    void publishWaveTableSet(WaveTableSet* set);
+    void collectRetiredWaveTableSets();
+    void freeWaveTableSet(WaveTableSet* set);
+    // Audio thread only
+    void retireWaveTableSet(WaveTableSet* set);
+    
+    float getVoiceFrequency(int v);
+    
+    void setQuality(OscQuality q);
+    void setUnison(int n);
+    void setUnisonSpread(float detuneCents, float spread);
+    void advanceQualityFade();
+    // Whether the current shapes render through the bank or oversampled.
+    // Unison copies only exist as bank lanes. Wavetables are band-limited
+    // for the host rate so always play as is
+    bool usesBank() { return (quality == EcoOscQuality || unison > 1) && currentShapeSet != UserOscShapeSet; }
+    bool isHigh() { return quality == HighOscQuality && unison == 1 && currentShapeSet != UserOscShapeSet; }
+    
+    // Last inputs and result of getVoiceFrequency() for each voice
+    struct FrequencyCacheEntry
+    {
+        float note, harmonic, fine, freq;
+        bool harmonicMode;
+        uint32 tuningGeneration;
+        bool valid = false;
+        float result;
+    };
+    FrequencyCacheEntry frequencyCache[NUM_STRINGS];
+    
     void (Oscillator::*shapeTick)(float& sample, int v, float freq, float shape);
     void sawSquareTick(float& sample, int v, float freq, float shape);
     void sineTriTick(float& sample, int v, float freq, float shape);
@@ -46,22 +374,77 @@ private:
     void triTick(float& sample, int v, float freq, float shape);
     void userTick(float& sample, int v, float freq, float shape);
     
+    void (Oscillator::*shapeBlock)(float* out, int v, float freq, float shape, int numSamples);
+    void sawSquareBlock(float* out, int v, float freq, float shape, int numSamples);
+    void sineTriBlock(float* out, int v, float freq, float shape, int numSamples);
+    void sawBlock(float* out, int v, float freq, float shape, int numSamples);
+    void pulseBlock(float* out, int v, float freq, float shape, int numSamples);
+    void sineBlock(float* out, int v, float freq, float shape, int numSamples);
+    void triBlock(float* out, int v, float freq, float shape, int numSamples);
+    void userBlock(float* out, int v, float freq, float shape, int numSamples);
+    
+    // Eco ticks render every lane of the bank at once, using ecoShapes[v].
+    // renderBank() then sums each voice's copies into the first lanes
+    void setBankLanes();
+    void renderBank();
+    void (Oscillator::*ecoTick)(float* samples);
+    void ecoSawSquareTick(float* samples);
+    void ecoSineTriTick(float* samples);
+    void ecoSawTick(float* samples);
+    void ecoPulseTick(float* samples);
+    void ecoSineTick(float* samples);
+    void ecoTriTick(float* samples);
+    
     tMBSaw saw[NUM_STRINGS];
     tMBPulse pulse[NUM_STRINGS];
     tCycle sine[NUM_STRINGS];
     tMBTriangle tri[NUM_STRINGS];
     
-    // Using seperate objects for pairs to easily maintain phase relation
-    tMBSaw sawPaired[NUM_STRINGS];
-    tMBPulse pulsePaired[NUM_STRINGS];
-    tCycle sinePaired[NUM_STRINGS];
-    tMBTriangle triPaired[NUM_STRINGS];
+    MorphOscillator morph[NUM_STRINGS];
     
-    tWaveOscS wave[NUM_STRINGS];
+    // Eco replaces the MB objects with naive PolyBLEP accumulators. Copy u
+    // of voice v is lane u * OSC_BANK_LANES + v
+    OscillatorBank bank;
+    alignas(64) float ecoShapes[OSC_BANK_MAX_LANES];
+    alignas(64) float ecoAmps[OSC_BANK_LANES];
+    alignas(64) float samplesA[OSC_BANK_MAX_LANES];
+    // Copies weighted by their offset from the filter send position
+    alignas(64) float spreadSamples[OSC_BANK_LANES];
+    
+    tOversampler decimator[NUM_STRINGS];
+    
+    std::atomic<float>* afpQuality;
+    OscQuality quality = StandardOscQuality;
+    OscQuality targetQuality = StandardOscQuality;
+    // Ducks the output across a quality change, so swapping generators
+    // can't click. Steps are per sample and only nonzero while fading
+    float qualityGain = 1.f;
+    float qualityGainStep = 0.f;
+    
+    std::atomic<float>* afpUnison;
+    std::atomic<float>* afpDetune;
+    std::atomic<float>* afpSpread;
+    int unison = 1;
+    int targetUnison = 1;
+    float unisonDetune = 0.f;
+    float unisonSpread = 0.f;
+    float unisonRatios[OSC_MAX_UNISON];
+    float unisonOffsets[OSC_MAX_UNISON];
+    float unisonGain = 1.f;
+    
+    // Audio thread only, replaced from pendingWaveSet in frame()
+    WaveTableSet* waveSet = nullptr;
+    std::atomic<WaveTableSet*> pendingWaveSet { nullptr };
+    // Sets the audio thread is done with, freed by the loader
+    RetiredList<WaveTableSet> retiredWaveSets;
+    std::atomic<double> waveSampleRate { 0. };
+    SharedResourcePointer<WaveTableLoader> waveTableLoader;
     
     float* sourceValues[MAX_NUM_UNIQUE_SKEWS];
 
     std::unique_ptr<SmoothedParameter> filterSend;
+    HeapBlock<float> filterSendBlock;
+    HeapBlock<float> voiceBlock;
     std::atomic<float>* isHarmonic_raw;
     std::atomic<float>* isStepped_raw;
 
@@ -70,8 +453,10 @@ private:
     
     float outSamples[2][NUM_STRINGS];
     
+    // The file last asked for on the message thread, and the last one that
+    // loaded, which it goes back to if a file fails so it can be retried
     File waveTableFile;
-    bool loadingTables = false;
+    File loadedWaveTableFile;
 };
 
 //==============================================================================
@@ -98,29 +483,50 @@ public:
     
 private:
     
-    void (LowFreqOscillator::*shapeTick)(float& sample, int v, float freq, float shape);
-    void sawSquareTick(float& sample, int v, float freq, float shape);
-    void sineTriTick(float& sample, int v, float freq, float shape);
-    void userTick(float& sample, int v, float freq, float shape);
-    void sawTick(float& sample, int v, float freq, float shape);
-    void pulseTick(float& sample, int v, float freq, float shape);
-    void sineTick(float& sample, int v, float freq, float shape);
-    void triTick(float& sample, int v, float freq, float shape);
+    // Shapes are only evaluated every control interval, on the same grid as
+    // the control rate parameters, and ramped in between. The bank's phase
+    // is always the one at the end of the current ramp
+    void updateVoice(int v);
+    void renderTargets();
+    void resyncVoice(int v, float phase);
+    // With tempo sync on, every voice runs at the division's rate and, while
+    // the host plays, takes its phase from the PPQ position at the start of
+    // each block, so it can't drift from the beat
+    void syncToHost();
     
-    RangedAudioParameter* sync;
+    // Voices whose lanes are rendered, which in global mode is only the
+    // first, broadcast to every voice after
+    ActiveVoices& renderedVoices();
     
-    tMBSaw saw[NUM_STRINGS];
-    tMBPulse pulse[NUM_STRINGS];
-    tCycle sine[NUM_STRINGS];
-    tMBTriangle tri[NUM_STRINGS];
+    // Shape ticks render every lane of the bank at once, using shapes[v]
+    void (LowFreqOscillator::*shapeTick)(float* samples);
+    void sawSquareTick(float* samples);
+    void sineTriTick(float* samples);
+    void sawTick(float* samples);
+    void pulseTick(float* samples);
+    void sineTick(float* samples);
+    void triTick(float* samples);
     
-    // Using seperate objects for pairs to easily maintain phase relation
-    tMBSaw sawPaired[NUM_STRINGS];
-    tMBPulse pulsePaired[NUM_STRINGS];
-    tCycle sinePaired[NUM_STRINGS];
-    tMBTriangle triPaired[NUM_STRINGS];
+    RangedAudioParameter* sync;
+    std::atomic<float>* afpTempoSync;
+    std::atomic<float>* afpDivision;
+    bool tempoSynced = false;
+    float syncedRate = 0.f;
     
-    tWaveOscS wave[NUM_STRINGS];
+    std::atomic<float>* afpGlobal;
+    bool global = false;
+    ActiveVoices globalVoices;
+    
+    // All shapes read the same phase so pairs stay in phase
+    OscillatorBank bank;
+    alignas(64) float shapes[OSC_BANK_LANES];
+    alignas(64) float samplesA[OSC_BANK_LANES];
+    alignas(64) float current[OSC_BANK_LANES];
+    alignas(64) float target[OSC_BANK_LANES];
+    alignas(64) float step[OSC_BANK_LANES];
+    int controlInterval = DEFAULT_CONTROL_INTERVAL;
+    float invControlInterval = 1.f / DEFAULT_CONTROL_INTERVAL;
+    int controlCountdown = 0;
     
     float* sourceValues[MAX_NUM_UNIQUE_SKEWS];
     float phaseReset;
@@ -144,12 +550,33 @@ public:
     void frame();
     void tick(float output[][NUM_STRINGS]);
     
+    // Takes effect from the next prepareToPlay, so a render started from
+    // the same seed always gives the same noise
+    void setSeed(uint32 s) { seed = s; }
+    
 private:
     
-    tNoise noise[NUM_STRINGS];
-    tSVF bandpass[NUM_STRINGS];
+    // Same coefficients tSVF_setFreq works out for a bandpass
+    void setBandpassFreq(int v, float freq);
+    
+    NoiseBank noise;
+    uint32 seed = DEFAULT_NOISE_SEED;
+    
+    // The bandpass runs tSVF's trapezoidal SVF on every lane at once. Color
+    // is only read on the control grid, and a voice's coefficients are only
+    // worked out again when its color has moved
+    alignas(64) float bandpassA1[OSC_BANK_LANES];
+    alignas(64) float bandpassA2[OSC_BANK_LANES];
+    alignas(64) float bandpassA3[OSC_BANK_LANES];
+    alignas(64) float bandpassIc1[OSC_BANK_LANES];
+    alignas(64) float bandpassIc2[OSC_BANK_LANES];
+    alignas(64) float noiseSamples[OSC_BANK_LANES];
+    float lastColor[NUM_STRINGS];
+    float invSampleRate = 1.f / 44100.f;
+    int controlCountdown = 0;
     
     std::unique_ptr<SmoothedParameter> filterSend;
+    HeapBlock<float> filterSendBlock;
     
     float* sourceValues[MAX_NUM_UNIQUE_SKEWS];
 };
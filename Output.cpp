@@ -18,11 +18,16 @@ AudioComponent(n, p, vts, cOutputParams, false)
 {
     master = std::make_unique<SmoothedParameter>(processor, vts, "Master");
     
+    params.setSmoothed(OutputAmp, true);
+    params.setSmoothed(OutputPan, true);
+    
     int temp = processor.leaf.clearOnAllocation;
     processor.leaf.clearOnAllocation = 1;
     tOversampler_init(&os[0], MASTER_OVERSAMPLE, 0, &processor.leaf);
     tOversampler_init(&os[1], MASTER_OVERSAMPLE, 0, &processor.leaf);
     processor.leaf.clearOnAllocation = temp;
+    
+    for (int v = 0; v < NUM_STRINGS; ++v) quietSamples[v] = 0;
 }
 
 Output::~Output()
@@ -34,22 +39,38 @@ Output::~Output()
 void Output::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     AudioComponent::prepareToPlay(sampleRate, samplesPerBlock);
+    masterBlock.allocate(samplesPerBlock, true);
 }
 
 void Output::frame()
 {
-    sampleInBlock = 0;
+    AudioComponent::frame();
+    
+    master->tickBlockNoHooksNoSmoothing(masterBlock, currentBlockSize);
 }
 
 void Output::tick(float input[NUM_STRINGS], float output[2], int numChannels)
 {
 //    float a = sampleInBlock * invBlockSize;
-    float m = master->tickNoHooksNoSmoothing();
+    float m = sampleInBlock < currentBlockSize ?
+    masterBlock[sampleInBlock] : master->tickNoHooksNoSmoothing();
+    
+    params.tick();
     
-    for (int v = 0; v < processor.numVoicesActive; ++v)
+    // Ringing voices are only let go once the list has been walked
+    uint32 quietVoices = 0;
+    for (int v : state.activeVoices.audible())
     {
-        float amp = quickParams[OutputAmp][v]->tick();
-        float pan = quickParams[OutputPan][v]->tick();
+        if (!state.activeVoices.isRinging(v)) quietSamples[v] = 0;
+        else if (fabsf(input[v]) >= RINGING_QUIET_LEVEL) quietSamples[v] = 0;
+        else if (++quietSamples[v] >= RINGING_QUIET_SAMPLES)
+        {
+            quietSamples[v] = 0;
+            quietVoices |= 1u << v;
+        }
+        
+        float amp = getParameterValue(OutputAmp, v);
+        float pan = getParameterValue(OutputPan, v);
         amp = amp < 0.f ? 0.f : amp;
         pan = LEAF_clip(-1.f, pan, 1.f);
         
@@ -92,6 +113,7 @@ void Output::tick(float input[NUM_STRINGS], float output[2], int numChannels)
         }
         else output[0] += sample;
     }
+    state.activeVoices.removeQuiet(quietVoices);
     
     float pedGain = 1.f;
     if (processor.pedalControlsMaster)
@@ -13,6 +13,10 @@
 #include "../Constants.h"
 #include "Utilities.h"
 #define MASTER_OVERSAMPLE 4
+// A voice taken off the active list is let go once its output has stayed
+// below this level for this many samples
+#define RINGING_QUIET_LEVEL 0.00001f
+#define RINGING_QUIET_SAMPLES 256
 //==============================================================================
 
 class Output : public AudioComponent
@@ -30,7 +34,9 @@ public:
 private:
     
     std::unique_ptr<SmoothedParameter> master;
+    HeapBlock<float> masterBlock;
     tOversampler os[2];
     float oversamplerArray[MASTER_OVERSAMPLE];
+    int quietSamples[NUM_STRINGS];
 };
 
@@ -0,0 +1,74 @@
+/*
+  ==============================================================================
+
+    SkewCurve.h
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Kept free of JUCE so Tests/SkewCurveTest.cpp can build it on its own
+//==============================================================================
+// Fast x^k for the skewed variants of mapping sources, where x is
+// normally in [0, 1]. Computed as exp2(k * log2(x)) with a 4 term atanh
+// series for log2 and a degree 6 polynomial for exp2. Relative error
+// against powf is within 1e-6 for k <= 2 and about 6e-6 at k = 10.
+// Zero, negative and denormal inputs give 0. Written without float
+// compares so process() vectorises across voices.
+class SkewCurve
+{
+public:
+    static inline float fastLog2(float x)
+    {
+        int32_t bits;
+        std::memcpy(&bits, &x, sizeof(float));
+        // Fold the mantissa into [sqrt(0.5), sqrt(2)) so the series converges fast
+        int32_t folded = bits + 0x004afb0d;
+        int32_t e = (folded >> 23) - 127;
+        bits = (folded & 0x007fffff) + 0x3f3504f3;
+        float m;
+        std::memcpy(&m, &bits, sizeof(float));
+        float s = (m - 1.f) / (m + 1.f);
+        float s2 = s * s;
+        return (float) e + s * (2.88539008f + s2 * (0.961796693f +
+                                s2 * (0.577078016f + s2 * 0.412198583f)));
+    }
+    
+    static inline float fastExp2(float y)
+    {
+        // Round to nearest, valid for |y| < 2^22
+        float n = (y + 12582912.f) - 12582912.f;
+        float f = y - n;
+        float p = 1.f + f * (0.693147181f + f * (0.240226507f + f * (0.0555041087f +
+                  f * (0.00961812911f + f * (0.00133335581f + f * 0.000154035304f)))));
+        // Anything below the normal range flushes to zero
+        int32_t ni = (int32_t) n;
+        int32_t bits = ((ni + 127) << 23) & -(int32_t) (ni >= -126);
+        float scale;
+        std::memcpy(&scale, &bits, sizeof(float));
+        return p * scale;
+    }
+    
+    static inline float apply(float x, float k)
+    {
+        float r = fastExp2(k * fastLog2(x));
+        int32_t xBits, rBits;
+        std::memcpy(&xBits, &x, sizeof(float));
+        std::memcpy(&rBits, &r, sizeof(float));
+        rBits &= -(int32_t) (xBits >= 0x00800000);
+        std::memcpy(&r, &rBits, sizeof(float));
+        return r;
+    }
+    
+    static inline void process(float* dest, const float* src, float k, int numValues)
+    {
+        for (int i = 0; i < numValues; ++i)
+        {
+            dest[i] = apply(src[i], k);
+        }
+    }
+};
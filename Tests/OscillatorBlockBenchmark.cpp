@@ -0,0 +1,182 @@
+/*
+  ==============================================================================
+
+    OscillatorBlockBenchmark.cpp
+
+    Times Oscillator's per sample path against rendering a span with no
+    MIDI events through processBlock(), here a whole block. This is a
+    timing mock only and doesn't run Oscillator itself, so it says nothing
+    about whether the two paths sound the same. LEAF isn't needed: a
+    PolyBLEP saw behind a non-inlined call stands in for tMBSaw, and
+    powf/log2f stand in for the tuner's mtof and ftom. Both paths go
+    through a frequency cache like getVoiceFrequency(), so the difference
+    is the per voice, per sample overhead tick() pays.
+
+        c++ -std=c++17 -O2 -o OscillatorBlockBenchmark Tests/OscillatorBlockBenchmark.cpp
+        ./OscillatorBlockBenchmark
+
+  ==============================================================================
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+namespace
+{
+    const int numVoices = 12;
+    const int blockSize = 256;
+    const int numBlocks = 20000;
+    const float invNumOscs = 1.f / 3.f;
+    
+    struct Saw
+    {
+        float phase = 0.f;
+        float inc = 0.f;
+    };
+    
+    __attribute__((noinline)) void sawSetFreq(Saw* s, float freq)
+    {
+        s->inc = freq * (1.f / 48000.f);
+    }
+    
+    __attribute__((noinline)) float sawTick(Saw* s)
+    {
+        float t = s->phase;
+        const float dt = s->inc;
+        float y = 2.f * t - 1.f;
+        if (t < dt)
+        {
+            t /= dt;
+            y -= t + t - t * t - 1.f;
+        }
+        else if (t > 1.f - dt)
+        {
+            t = (t - 1.f) / dt;
+            y -= t * t + t + t + 1.f;
+        }
+        s->phase += dt;
+        if (s->phase >= 1.f) s->phase -= 1.f;
+        return y;
+    }
+    
+    float mtof(float m) { return 440.f * std::pow(2.f, (m - 69.f) / 12.f); }
+    float ftom(float f) { return 12.f * std::log2(f / 440.f) + 69.f; }
+    
+    struct MockOscillator
+    {
+        Saw saw[numVoices];
+        float note[numVoices];
+        float harmonic = 2.f, fine = 3.f, freq = 0.f, amp = 0.8f;
+        float filterSend[blockSize];
+        float voiceBlock[blockSize];
+        
+        struct Cache { float note, harmonic, fine, freq, result; bool valid = false; };
+        Cache cache[numVoices];
+        
+        float getVoiceFrequency(int v)
+        {
+            Cache& c = cache[v];
+            if (c.valid && c.note == note[v] && c.harmonic == harmonic && c.fine == fine && c.freq == freq)
+            {
+                return c.result;
+            }
+            c = { note[v], harmonic, fine, freq, 0.f, true };
+            const float n = ftom(mtof(note[v]) * (std::round(harmonic) + 1.f));
+            return c.result = mtof(std::fmin(127.f, std::fmax(0.f, n + fine * 0.01f))) + freq;
+        }
+        
+        void tick(float output[][numVoices], int sampleInBlock)
+        {
+            const float f = filterSend[sampleInBlock];
+            for (int v = 0; v < numVoices; ++v)
+            {
+                sawSetFreq(&saw[v], getVoiceFrequency(v));
+                float sample = sawTick(&saw[v]) * amp;
+                sample *= invNumOscs;
+                output[0][v] += sample * f;
+                output[1][v] += sample * (1.f - f);
+            }
+        }
+        
+        void processBlock(float* const f1Sends[numVoices], float* const f2Sends[numVoices],
+                          int sampleInBlock, int numSamples)
+        {
+            const float* f = filterSend + sampleInBlock;
+            for (int v = 0; v < numVoices; ++v)
+            {
+                sawSetFreq(&saw[v], getVoiceFrequency(v));
+                for (int i = 0; i < numSamples; ++i) voiceBlock[i] = sawTick(&saw[v]);
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    float sample = voiceBlock[i] * amp;
+                    sample *= invNumOscs;
+                    f1Sends[v][i] += sample * f[i];
+                    f2Sends[v][i] += sample * (1.f - f[i]);
+                }
+            }
+        }
+        
+        MockOscillator()
+        {
+            for (int v = 0; v < numVoices; ++v) note[v] = 40.f + v * 3.f;
+            for (int i = 0; i < blockSize; ++i) filterSend[i] = 0.5f + 0.001f * i;
+        }
+    };
+    
+    double runPerSample(MockOscillator& osc, float& sink)
+    {
+        float output[2][numVoices];
+        auto start = std::chrono::steady_clock::now();
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            for (int s = 0; s < blockSize; ++s)
+            {
+                for (int v = 0; v < numVoices; ++v) output[0][v] = output[1][v] = 0.f;
+                osc.tick(output, s);
+                sink += output[0][0];
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - start).count();
+    }
+    
+    // The processor's side: clear the sends and render the span in one call
+    double runBlock(MockOscillator& osc, float& sink)
+    {
+        static float sends[2][numVoices][blockSize];
+        float* f1[numVoices];
+        float* f2[numVoices];
+        for (int v = 0; v < numVoices; ++v)
+        {
+            f1[v] = sends[0][v];
+            f2[v] = sends[1][v];
+        }
+        auto start = std::chrono::steady_clock::now();
+        for (int b = 0; b < numBlocks; ++b)
+        {
+            for (int v = 0; v < numVoices; ++v)
+            {
+                for (int i = 0; i < blockSize; ++i) f1[v][i] = f2[v][i] = 0.f;
+            }
+            osc.processBlock(f1, f2, 0, blockSize);
+            for (int s = 0; s < blockSize; ++s) sink += sends[0][0][s];
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(end - start).count();
+    }
+}
+
+int main()
+{
+    float sink = 0.f;
+    static MockOscillator perSample, block;
+    const double perSampleTime = runPerSample(perSample, sink);
+    const double blockTime = runBlock(block, sink);
+    
+    std::printf("%d blocks of %d samples, %d voices\n", numBlocks, blockSize, numVoices);
+    std::printf("per sample %.3fs\n", perSampleTime);
+    std::printf("block      %.3fs (%.2fx)\n", blockTime, perSampleTime / blockTime);
+    std::printf("(%g)\n", sink);
+    return 0;
+}
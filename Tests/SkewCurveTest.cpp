@@ -0,0 +1,154 @@
+/*
+  ==============================================================================
+
+    SkewCurveTest.cpp
+
+    Checks SkewCurve against powf and times the two. Needs nothing but the
+    header, so from the Components folder:
+
+        c++ -std=c++17 -O2 -o SkewCurveTest Tests/SkewCurveTest.cpp
+        ./SkewCurveTest
+
+    Returns non-zero if any check fails.
+
+  ==============================================================================
+*/
+
+#include "../SkewCurve.h"
+
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace
+{
+    int failures = 0;
+    
+    void check(bool condition, const char* what, float x, float k, float got, float expected)
+    {
+        if (condition) return;
+        std::printf("FAIL %s: x = %g, k = %g, got %g, expected %g\n",
+                    what, x, k, got, expected);
+        ++failures;
+    }
+    
+    // The bounds given in SkewCurve.h, with a little headroom
+    float maxRelativeError(float k)
+    {
+        return k <= 2.f ? 1.5e-6f : 8e-6f;
+    }
+    
+    void testAccuracy()
+    {
+        const int numX = 1 << 20;
+        const float skews[] = { 0.1f, 0.25f, 0.5f, 0.75f, 1.f, 1.5f, 2.f,
+                                3.f, 4.f, 5.f, 7.5f, 10.f };
+        for (float k : skews)
+        {
+            double worst = 0.0;
+            for (int i = 1; i <= numX; ++i)
+            {
+                const float x = (float) i / numX;
+                const float expected = std::pow(x, k);
+                const float got = SkewCurve::apply(x, k);
+                if (expected < FLT_MIN)
+                {
+                    // Below the normal range SkewCurve flushes to zero
+                    check(got < FLT_MIN, "flush", x, k, got, expected);
+                    continue;
+                }
+                const double error = std::fabs(((double) got - expected) / expected);
+                if (error > worst) worst = error;
+                check(error <= maxRelativeError(k), "relative error", x, k, got, expected);
+            }
+            std::printf("k = %-5g max relative error %.3g\n", k, worst);
+        }
+        
+        // The ends of the range should come out exact enough to compare
+        for (float k : skews)
+        {
+            check(std::fabs(SkewCurve::apply(1.f, k) - 1.f) <= 1e-6f, "x = 1", 1.f, k,
+                  SkewCurve::apply(1.f, k), 1.f);
+        }
+    }
+    
+    void testEdgeCases()
+    {
+        const float zeroes[] = { 0.f, -0.f, -FLT_MIN, -0.5f, -1.f, -1000.f,
+                                 FLT_MIN * 0.5f, FLT_MIN * 0.001f, FLT_TRUE_MIN };
+        for (float k : { 0.1f, 1.f, 2.f, 10.f })
+        {
+            for (float x : zeroes)
+            {
+                const float got = SkewCurve::apply(x, k);
+                check(got == 0.f, "zero, negative or denormal", x, k, got, 0.f);
+            }
+            // Smallest normal input still goes through the curve
+            const float got = SkewCurve::apply(FLT_MIN, 0.1f);
+            check(got > 0.f, "smallest normal", FLT_MIN, 0.1f, got, std::pow(FLT_MIN, 0.1f));
+        }
+        
+        // process() must agree with apply() exactly
+        float src[37], dest[37];
+        for (int i = 0; i < 37; ++i) src[i] = (float) (i - 3) / 33.f;
+        SkewCurve::process(dest, src, 2.5f, 37);
+        for (int i = 0; i < 37; ++i)
+        {
+            check(dest[i] == SkewCurve::apply(src[i], 2.5f), "process", src[i], 2.5f,
+                  dest[i], SkewCurve::apply(src[i], 2.5f));
+        }
+    }
+    
+    template <typename Fn>
+    double timeNs(Fn&& fn, int repeats)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (int r = 0; r < repeats; ++r) fn();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count();
+    }
+    
+    void benchmark()
+    {
+        // One block's worth of skewed values for every voice, as
+        // MappingSourceModel::computeSkews does
+        const int numValues = 512 * 12;
+        const int repeats = 2000;
+        std::vector<float> src(numValues), dest(numValues);
+        for (int i = 0; i < numValues; ++i) src[i] = (float) (i + 1) / numValues;
+        
+        volatile float sink = 0.f;
+        const float k = 2.7f;
+        double powNs = timeNs([&]
+        {
+            for (int i = 0; i < numValues; ++i) dest[i] = std::pow(src[i], k);
+            sink = sink + dest[numValues / 2];
+        }, repeats);
+        double skewNs = timeNs([&]
+        {
+            SkewCurve::process(dest.data(), src.data(), k, numValues);
+            sink = sink + dest[numValues / 2];
+        }, repeats);
+        
+        const double n = (double) numValues * repeats;
+        std::printf("powf      %.2f ns/value\n", powNs / n);
+        std::printf("SkewCurve %.2f ns/value (%.1fx)\n", skewNs / n, powNs / skewNs);
+    }
+}
+
+int main()
+{
+    testAccuracy();
+    testEdgeCases();
+    benchmark();
+    
+    if (failures > 0)
+    {
+        std::printf("%d checks failed\n", failures);
+        return 1;
+    }
+    std::printf("All checks passed\n");
+    return 0;
+}
@@ -35,9 +35,14 @@ public:
         isMTS = f;
         MTSOnOff();
         mtofptr = setMtoFFunction(isMTS);
+        generation++;
     };
     float mtof (float mn);
     auto const getIsMTS() {return isMTS;};
+    // Changes whenever mtof() may start returning something different, so
+    // callers can cache frequencies. An MTS-ESP master can retune at any
+    // time without telling us, so while MTS is on this is not enough
+    uint32 getGeneration() {return generation.load(std::memory_order_relaxed);};
 private:
     typedef float (TuningControl::*MidiToFreq)(float);
     static MidiToFreq setMtoFFunction(bool);
@@ -46,6 +51,7 @@ private:
     float _mtof(float mn);
     MTSClient *client;
     bool isMTS;
+    std::atomic<uint32> generation {0};
     void MTSOnOff();
     
 
@@ -11,6 +11,28 @@
 #include "Utilities.h"
 #include "../PluginProcessor.h"
 
+void BlockSmoothedValue::renderRamp(float* out, int numSamples) const
+{
+    const float target = getTargetValue();
+    const int remaining = getRemainingSteps();
+    int i = 0;
+    if (remaining > 0)
+    {
+        // Closed form of getNextValue() adding step each sample, with the
+        // last step of the ramp landing exactly on the target
+        const float start = getCurrentValue();
+        const float step = (target - start) / (float) remaining;
+        const int numRamped = jmin(remaining - 1, numSamples);
+        for (; i < numRamped; ++i)
+        {
+            out[i] = start + step * (float) (i + 1);
+        }
+    }
+    if (i < numSamples) FloatVectorOperations::fill(out + i, target, numSamples - i);
+}
+
+//==============================================================================
+
 SmoothedParameter::SmoothedParameter(ElectroAudioProcessor& processor, AudioProcessorValueTreeState& vts,
                                      String paramId) :
 processor(processor)
@@ -78,7 +100,7 @@ void SmoothedParameter::tickSkews()
     for (int i = 0; i < processor.numInvParameterSkews; ++i)
     {
         float invSkew = processor.quickInvParameterSkews[i];
-        values[i] = powf(value, invSkew);
+        values[i] = SkewCurve::apply(value, invSkew);
     }
 }
 
@@ -89,7 +111,7 @@ void SmoothedParameter::tickSkewsNoHooks()
     for (int i = 0; i < processor.numInvParameterSkews; ++i)
     {
         float invSkew = processor.quickInvParameterSkews[i];
-        values[i] = powf(value, invSkew);
+        values[i] = SkewCurve::apply(value, invSkew);
     }
 }
 
@@ -104,7 +126,7 @@ void SmoothedParameter::tickSkewsNoSmoothing()
     for (int i = 0; i < processor.numInvParameterSkews; ++i)
     {
         float invSkew = processor.quickInvParameterSkews[i];
-        values[i] = powf(value, invSkew);
+        values[i] = SkewCurve::apply(value, invSkew);
     }
 }
 
@@ -114,10 +136,26 @@ void SmoothedParameter::tickSkewsNoHooksNoSmoothing()
     for (int i = 0; i < processor.numInvParameterSkews; ++i)
     {
         float invSkew = processor.quickInvParameterSkews[i];
-        values[i] = powf(value, invSkew);
+        values[i] = SkewCurve::apply(value, invSkew);
     }
 }
 
+void SmoothedParameter::tickBlockNoHooks(float* out, int numSamples)
+{
+    smoothed.setTargetValue(raw->load(std::memory_order_relaxed));
+    smoothed.renderRamp(out, numSamples);
+}
+
+void SmoothedParameter::tickBlockNoHooksNoSmoothing(float* out, int numSamples)
+{
+    FloatVectorOperations::fill(out, value = raw->load(std::memory_order_relaxed), numSamples);
+}
+
+void SmoothedParameter::advance(int numSamples)
+{
+    if (numSamples > 0) value = smoothed.skip(numSamples);
+}
+
 float SmoothedParameter::skip(int numSamples)
 {
     float target = raw->load(std::memory_order_relaxed);
@@ -227,20 +265,555 @@ void SmoothedParameter::prepareToPlay(double sampleRate, int samplesPerBlock)
 //==============================================================================
 //==============================================================================
 
+const float ParameterStore::unitScalar = 1.0f;
+
+ParameterStore::ParameterStore(AudioProcessorValueTreeState& vts, const String& prefix,
+                               const StringArray& paramNames) :
+numParams(paramNames.size())
+{
+    lanes.allocate(numParams, true);
+    for (int p = 0; p < numParams; ++p)
+    {
+        String pn = prefix + " " + paramNames[p];
+        raws.add(vts.getRawParameterValue(pn));
+        ranges.add(vts.getParameter(pn)->getNormalisableRange());
+        
+        ParameterLanes& l = lanes[p];
+        l.base = raws[p]->load();
+        for (int v = 0; v < NUM_VOICE_LANES; ++v)
+        {
+            l.current[v] = l.next[v] = l.target[v] = l.base;
+            l.step[v] = 0.f;
+            l.countdown[v] = 0;
+        }
+        l.smoothed = false;
+        l.ramp = nullptr;
+        l.rampLength = 0;
+        l.rampRendered = false;
+        
+        for (int i = 0; i < 3; ++i) hooks.add(HookSettings());
+        rates.add(AudioRate);
+    }
+    
+    table = new ModulationTable();
+    table->routings.allocate(numParams * 3, true);
+    table->isModulated.allocate(numParams, true);
+    table->rates.allocate(numParams, true);
+    for (int p = 0; p < numParams; ++p) table->rates[p] = AudioRate;
+    for (int rate = 0; rate < ParameterRateNil; ++rate) table->rateEnd[rate] = 0;
+}
+
+ParameterStore::~ParameterStore()
+{
+    collectRetiredTables();
+    delete pendingTable.exchange(nullptr);
+    delete table;
+}
+
+void ParameterStore::prepareToPlay(double sampleRate, int samplesPerBlock)
+{
+    // Matches the 10ms linear ramp of SmoothedParameter
+    stepsToTarget = (int) std::floor(0.010 * sampleRate);
+    blockSize = samplesPerBlock;
+    tickIndex = 0;
+    
+    int numSmoothed = 0;
+    for (int p = 0; p < numParams; ++p)
+    {
+        if (lanes[p].smoothed) numSmoothed++;
+    }
+    rampData.allocate(numSmoothed * blockSize * NUM_VOICE_LANES, true);
+    
+    float* ramp = rampData;
+    for (int p = 0; p < numParams; ++p)
+    {
+        ParameterLanes& l = lanes[p];
+        for (int v = 0; v < NUM_VOICE_LANES; ++v)
+        {
+            l.target[v] = l.current[v];
+            l.countdown[v] = 0;
+        }
+        l.ramp = nullptr;
+        l.rampLength = 0;
+        l.rampRendered = false;
+        if (l.smoothed)
+        {
+            l.ramp = ramp;
+            ramp += blockSize * NUM_VOICE_LANES;
+        }
+    }
+}
+
+void ParameterStore::frame()
+{
+    // Pick up mapping edits only at block boundaries. The old table can't
+    // be freed here, so push it on the retired list for the message thread
+    if (ModulationTable* newTable = pendingTable.exchange(nullptr, std::memory_order_acquire))
+    {
+        retiredTables.push(table);
+        table = newTable;
+    }
+    
+    const int samplesUsed = jmin(tickIndex, blockSize);
+    tickIndex = 0;
+    
+    controlInterval = pendingControlInterval.load(std::memory_order_relaxed);
+    invControlInterval = 1.f / controlInterval;
+    controlCountdown = 0;
+    
+    const bool snap = resetPending.exchange(false, std::memory_order_relaxed);
+    for (int p = 0; p < numParams; ++p)
+    {
+        ParameterLanes& l = lanes[p];
+        l.base = raws.getUnchecked(p)->load(std::memory_order_relaxed);
+        if (snap)
+        {
+            for (int v = 0; v < NUM_VOICE_LANES; ++v)
+            {
+                l.current[v] = l.next[v] = l.target[v] = l.base;
+                l.step[v] = 0.f;
+                l.countdown[v] = 0;
+            }
+            l.rampRendered = false;
+        }
+        
+        // Nothing changes within the block, so set it once here and skip
+        // the parameter entirely in tick()
+        if (!table->isModulated[p] && !l.smoothed)
+        {
+            for (int v = 0; v < NUM_VOICE_LANES; ++v) l.current[v] = l.base;
+            continue;
+        }
+        
+        // current already holds the last ramp row tick() copied, so only the
+        // countdowns need to catch up with the samples used
+        if (l.rampRendered)
+        {
+            for (int v = 0; v < NUM_VOICE_LANES; ++v)
+            {
+                l.countdown[v] = jmax(l.countdown[v] - samplesUsed, 0);
+                if (l.countdown[v] > 0) l.step[v] = (l.target[v] - l.current[v]) / l.countdown[v];
+            }
+            l.rampRendered = false;
+        }
+        
+        if (!table->isModulated[p] && l.ramp != nullptr && stepsToTarget > 0)
+        {
+            renderRamp(l);
+        }
+    }
+}
+
+void ParameterStore::renderRamp(ParameterLanes& l)
+{
+    // Same as SmoothedValue::setTargetValue, but the target can only change
+    // here, so the whole block is a fixed start and step per lane
+    int length = 0;
+    for (int v = 0; v < NUM_VOICE_LANES; ++v)
+    {
+        if (l.base != l.target[v])
+        {
+            l.target[v] = l.base;
+            l.countdown[v] = stepsToTarget;
+            l.step[v] = (l.target[v] - l.current[v]) / stepsToTarget;
+        }
+        length = jmax(length, l.countdown[v]);
+    }
+    l.rampLength = jmin(length, blockSize);
+    l.rampRendered = true;
+    
+    // Rows are laid out sample by sample so tick() copies one contiguous row.
+    // The compare is on ints so this stays a straight vector select
+    for (int s = 0; s < l.rampLength; ++s)
+    {
+        float* row = l.ramp + s * NUM_VOICE_LANES;
+        const float n = (float) (s + 1);
+        for (int v = 0; v < NUM_VOICE_LANES; ++v)
+        {
+            row[v] = s + 1 < l.countdown[v] ? l.current[v] + l.step[v] * n : l.target[v];
+        }
+    }
+}
+
+void ParameterStore::tick()
+{
+    // Control rate targets are evaluated on a grid starting at the beginning
+    // of the block, block rate targets only on its first sample
+    const bool controlTick = controlCountdown == 0;
+    if (controlTick) controlCountdown = controlInterval;
+    --controlCountdown;
+    const bool due[ParameterRateNil] = { true, controlTick, tickIndex == 0 };
+    
+    for (int p = 0; p < numParams; ++p)
+    {
+        ParameterLanes& l = lanes[p];
+        if (l.rampRendered)
+        {
+            if (tickIndex < l.rampLength)
+            {
+                const float* row = l.ramp + tickIndex * NUM_VOICE_LANES;
+                for (int v = 0; v < NUM_VOICE_LANES; ++v) l.current[v] = row[v];
+            }
+            continue;
+        }
+        if (!table->isModulated[p] && !l.smoothed) continue;
+        if (!due[table->rates[p]]) continue;
+        for (int v = 0; v < NUM_VOICE_LANES; ++v) l.next[v] = l.base;
+    }
+    
+    int start = 0;
+    for (int rate = 0; rate < ParameterRateNil; ++rate)
+    {
+        if (due[rate]) applyRoutings(start, table->rateEnd[rate]);
+        start = table->rateEnd[rate];
+    }
+    
+    for (int p = 0; p < numParams; ++p)
+    {
+        ParameterLanes& l = lanes[p];
+        if (l.rampRendered) continue;
+        if (!l.smoothed || stepsToTarget <= 0)
+        {
+            if (!table->isModulated[p]) continue;
+            
+            if (table->rates[p] == ControlRate)
+            {
+                // Head for the latest grid value over the next interval
+                if (controlTick)
+                {
+                    for (int v = 0; v < NUM_VOICE_LANES; ++v)
+                    {
+                        l.step[v] = (l.next[v] - l.current[v]) * invControlInterval;
+                    }
+                }
+                for (int v = 0; v < NUM_VOICE_LANES; ++v) l.current[v] += l.step[v];
+            }
+            else if (due[table->rates[p]])
+            {
+                for (int v = 0; v < NUM_VOICE_LANES; ++v) l.current[v] = l.next[v];
+            }
+            continue;
+        }
+        
+        // Same behavior as SmoothedValue<float, ValueSmoothingTypes::Linear>
+        // with setTargetValue followed by getNextValue
+        for (int v = 0; v < NUM_VOICE_LANES; ++v)
+        {
+            if (l.next[v] != l.target[v])
+            {
+                l.target[v] = l.next[v];
+                l.countdown[v] = stepsToTarget;
+                l.step[v] = (l.target[v] - l.current[v]) / stepsToTarget;
+            }
+            if (l.countdown[v] > 0)
+            {
+                --l.countdown[v];
+                l.current[v] = l.countdown[v] > 0 ? l.current[v] + l.step[v] : l.target[v];
+            }
+        }
+    }
+    
+    ++tickIndex;
+}
+
+bool ParameterStore::isStatic()
+{
+    if (table->numRoutings > 0) return false;
+    for (int p = 0; p < numParams; ++p)
+    {
+        if (lanes[p].smoothed) return false;
+    }
+    return true;
+}
+
+void ParameterStore::skip(int numSamples)
+{
+    jassert(isStatic());
+    tickIndex += numSamples;
+}
+
+void ParameterStore::applyRoutings(int start, int end)
+{
+    // Cost here only depends on how many mappings are actually active
+    for (int r = start; r < end; ++r)
+    {
+        const ModulationRouting& route = table->routings[r];
+        float* next = lanes[route.target].next;
+        if (route.sourceStride == 1 && route.scalarStride == 1)
+        {
+            for (int v = 0; v < NUM_STRINGS; ++v)
+            {
+                next[v] += ((route.source[v] * route.length) + route.min) * route.scalar[v];
+            }
+        }
+        else
+        {
+            for (int v = 0; v < NUM_STRINGS; ++v)
+            {
+                next[v] += ((route.source[v * route.sourceStride] * route.length) + route.min) *
+                route.scalar[v * route.scalarStride];
+            }
+        }
+    }
+}
+
+void ParameterStore::setSmoothed(int p, bool smoothed)
+{
+    lanes[p].smoothed = smoothed;
+}
+
+void ParameterStore::setRate(int p, ParameterRate rate)
+{
+    rates.set(p, rate);
+    compileRoutings();
+}
+
+void ParameterStore::setControlInterval(int numSamples)
+{
+    pendingControlInterval.store(jmax(numSamples, 1), std::memory_order_relaxed);
+}
+
+void ParameterStore::setHook(int p, int index, const float* sources, int numSources,
+                             float min, float max)
+{
+    HookSettings& hook = hooks.getReference(p*3 + index);
+    hook.source = sources;
+    hook.numSources = numSources;
+    hook.min = min;
+    hook.max = max;
+    compileRoutings();
+}
+
+void ParameterStore::setHookRange(int p, int index, float min, float max)
+{
+    HookSettings& hook = hooks.getReference(p*3 + index);
+    hook.min = min;
+    hook.max = max;
+    compileRoutings();
+}
+
+void ParameterStore::setHookScalar(int p, int index, const float* scalars, int numScalars)
+{
+    HookSettings& hook = hooks.getReference(p*3 + index);
+    hook.scalar = scalars;
+    hook.numScalars = numScalars;
+    compileRoutings();
+}
+
+void ParameterStore::resetHook(int p, int index)
+{
+    hooks.getReference(p*3 + index) = HookSettings();
+    compileRoutings();
+}
+
+void ParameterStore::resetHookScalar(int p, int index)
+{
+    HookSettings& hook = hooks.getReference(p*3 + index);
+    hook.scalar = &unitScalar;
+    hook.numScalars = 1;
+    compileRoutings();
+}
+
+void ParameterStore::compileRoutings()
+{
+    collectRetiredTables();
+    
+    ModulationTable* newTable = new ModulationTable();
+    newTable->routings.allocate(numParams * 3, true);
+    newTable->isModulated.allocate(numParams, true);
+    newTable->rates.allocate(numParams, true);
+    
+    int numRoutings = 0;
+    for (int p = 0; p < numParams; ++p)
+    {
+        newTable->isModulated[p] = false;
+        newTable->rates[p] = rates[p];
+    }
+    for (int rate = 0; rate < ParameterRateNil; ++rate)
+    {
+        for (int p = 0; p < numParams; ++p)
+        {
+            if (rates[p] != rate) continue;
+            for (int i = 0; i < 3; ++i)
+            {
+                HookSettings& hook = hooks.getReference(p*3 + i);
+                if (hook.source == nullptr) continue;
+                
+                ModulationRouting& route = newTable->routings[numRoutings++];
+                route.source = hook.source;
+                route.sourceStride = hook.numSources > 1 ? 1 : 0;
+                route.scalar = hook.scalar;
+                route.scalarStride = hook.numScalars > 1 ? 1 : 0;
+                route.target = p;
+                route.min = hook.min;
+                route.length = hook.max - hook.min;
+                newTable->isModulated[p] = true;
+            }
+        }
+        newTable->rateEnd[rate] = numRoutings;
+    }
+    newTable->numRoutings = numRoutings;
+    
+    // If the audio thread never got to the previous edit it's safe to drop
+    delete pendingTable.exchange(newTable, std::memory_order_acq_rel);
+}
+
+void ParameterStore::collectRetiredTables()
+{
+    retiredTables.collect([] (ModulationTable* t) { delete t; });
+}
+
+//==============================================================================
+//==============================================================================
+
+ActiveVoices::ActiveVoices()
+{
+    for (int i = 0; i < NUM_STRINGS; ++i)
+    {
+        voices[i] = 0;
+        audibleVoices[i] = 0;
+    }
+}
+
+void ActiveVoices::add(int v)
+{
+    if (contains(v)) return;
+    mask |= 1u << v;
+    ringing &= ~(1u << v);
+    rebuild();
+}
+
+void ActiveVoices::remove(int v)
+{
+    if (!contains(v)) return;
+    mask &= ~(1u << v);
+    ringing |= 1u << v;
+    rebuild();
+}
+
+void ActiveVoices::removeAll(uint32 voiceMask)
+{
+    voiceMask &= mask;
+    if (voiceMask == 0) return;
+    mask &= ~voiceMask;
+    ringing |= voiceMask;
+    rebuild();
+}
+
+void ActiveVoices::removeQuiet(uint32 voiceMask)
+{
+    voiceMask &= ringing;
+    if (voiceMask == 0) return;
+    ringing &= ~voiceMask;
+    rebuild();
+}
+
+void ActiveVoices::clear()
+{
+    mask = 0;
+    ringing = 0;
+    numVoices = 0;
+    numAudible = 0;
+}
+
+void ActiveVoices::rebuild()
+{
+    numVoices = 0;
+    numAudible = 0;
+    for (int v = 0; v < NUM_STRINGS; ++v)
+    {
+        if (contains(v)) voices[numVoices++] = v;
+        if (contains(v) || isRinging(v)) audibleVoices[numAudible++] = v;
+    }
+}
+
+//==============================================================================
+
+MappingSourceRegistry::MappingSourceRegistry()
+{
+    for (int i = 0; i < MAX_NUM_MAPPING_SOURCES; ++i) mappingCounts[i] = 0;
+}
+
+int MappingSourceRegistry::add(MappingSourceModel* source)
+{
+    jassert(sources.size() < MAX_NUM_MAPPING_SOURCES);
+    sources.add(source);
+    return sources.size() - 1;
+}
+
+void MappingSourceRegistry::addMapping(int id)
+{
+    mappingCounts[id].fetch_add(1, std::memory_order_relaxed);
+}
+
+void MappingSourceRegistry::removeMapping(int id)
+{
+    mappingCounts[id].fetch_sub(1, std::memory_order_relaxed);
+}
+
+//==============================================================================
+
+ComponentState::Registry& ComponentState::getRegistry()
+{
+    static Registry registry;
+    return registry;
+}
+
+ComponentState* ComponentState::findLocked(Registry& registry, ElectroAudioProcessor& p)
+{
+    for (auto* s : registry.states)
+    {
+        if (s->processor == &p) return s;
+    }
+    return nullptr;
+}
+
+ComponentState& ComponentState::acquire(ElectroAudioProcessor& p)
+{
+    Registry& registry = getRegistry();
+    const ScopedLock sl (registry.lock);
+    ComponentState* s = findLocked(registry, p);
+    if (s == nullptr) s = registry.states.add(new ComponentState(p));
+    s->numUsers++;
+    return *s;
+}
+
+void ComponentState::release(ElectroAudioProcessor& p)
+{
+    Registry& registry = getRegistry();
+    const ScopedLock sl (registry.lock);
+    ComponentState* s = findLocked(registry, p);
+    if (s == nullptr) return;
+    if (--s->numUsers == 0) registry.states.removeObject(s);
+}
+
+ComponentState* ComponentState::find(ElectroAudioProcessor& p)
+{
+    Registry& registry = getRegistry();
+    const ScopedLock sl (registry.lock);
+    return findLocked(registry, p);
+}
+
+//==============================================================================
+
 MappingSourceModel::MappingSourceModel(ElectroAudioProcessor& p, const String &name,
                                        bool perVoice, bool bipolar, Colour colour) :
 name(name),
 numSourcePointers(perVoice ? NUM_STRINGS : 1),
 bipolar(bipolar),
 colour(colour),
-modelProcessor(p)
+modelProcessor(p),
+modelState(ComponentState::acquire(p))
 {
+    for (int i = 0; i < MAX_NUM_UNIQUE_SKEWS; ++i) skewUsers[i] = 0;
+    sourceId = modelState.sourceRegistry.add(this);
+    mappingCount = &modelState.sourceRegistry.getMappingCount(sourceId);
     p.addMappingSource(this);
 }
 
 MappingSourceModel::~MappingSourceModel()
 {
-    
+    ComponentState::release(modelProcessor);
 }
 
 float** MappingSourceModel::getValuePointerArray(int i)
@@ -253,18 +826,57 @@ int MappingSourceModel::getNumSourcePointers()
     return numSourcePointers;
 }
 
+void MappingSourceModel::computeSkews(int numValues)
+{
+    uint32 skews = usedSkews.load(std::memory_order_relaxed);
+    if (skews == 0) return;
+    
+    const float* values = *sources[0];
+    for (int i = 1; i < modelProcessor.numInvParameterSkews; ++i)
+    {
+        if ((skews & (1u << i)) == 0) continue;
+        SkewCurve::process(*sources[i], values,
+                           modelProcessor.quickInvParameterSkews[i], numValues);
+    }
+}
+
+void MappingSourceModel::broadcast(int numValues)
+{
+    uint32 skews = usedSkews.load(std::memory_order_relaxed) | 1u;
+    for (int i = 0; i < modelProcessor.numInvParameterSkews; ++i)
+    {
+        if ((skews & (1u << i)) == 0) continue;
+        float* values = *sources[i];
+        FloatVectorOperations::fill(values + 1, values[0], numValues - 1);
+    }
+}
+
+void MappingSourceModel::addSkewUser(int skewIndex)
+{
+    // The unskewed values are always computed
+    if (skewIndex <= 0) return;
+    if (skewUsers[skewIndex]++ == 0) usedSkews.fetch_or(1u << skewIndex);
+}
+
+void MappingSourceModel::removeSkewUser(int skewIndex)
+{
+    if (skewIndex <= 0 || skewUsers[skewIndex] == 0) return;
+    if (--skewUsers[skewIndex] == 0) usedSkews.fetch_and(~(1u << skewIndex));
+}
+
 //==============================================================================
 //==============================================================================
 
 MappingTargetModel::MappingTargetModel(ElectroAudioProcessor& p, const String &name,
-                                       OwnedArray<SmoothedParameter>& targetParameters,
+                                       ParameterStore& store, int paramId,
                                        int index) :
 processor(p),
 name(name),
-targetParameters(targetParameters),
+store(store),
+paramId(paramId),
 index(index)
 {
-    invSkew = targetParameters[0]->getInvSkew();
+    invSkew = store.getInvSkew(paramId);
 }
 
 MappingTargetModel::~MappingTargetModel()
@@ -280,21 +892,29 @@ void MappingTargetModel::setMapping(MappingSourceModel* source, float e, bool se
 {
     if (source == nullptr) return;
     
+    if (currentSource != nullptr) currentSource->removeMapping();
+    source->addMapping();
+    
+    // Still read by the processor and UI by name
     if (currentSource != nullptr) processor.sourceMappingCounts.getReference(currentSource->name)--;
     processor.sourceMappingCounts.getReference(source->name)++;
     
+    int skew = processor.invParameterSkews.indexOf(invSkew);
+    if (currentSource != nullptr) currentSource->removeSkewUser(sourceSkew);
+    source->addSkewUser(skew);
+    sourceSkew = skew;
+    
     currentSource = source;
     bipolar = source->isBipolar();
     
-    int i = 0;
     int n = source->getNumSourcePointers();
     
     start = 0.f;
     end = e;
     if (bipolar)
     {
-        NormalisableRange<float>& range = targetParameters[0]->getRange();
-        float center = targetParameters[0]->getRawValue();
+        NormalisableRange<float>& range = store.getRange(paramId);
+        float center = store.getRawValue(paramId);
         float pCenter = range.convertTo0to1(center);
         float pOffset = range.convertTo0to1(range.getRange().clipValue(center+end)) - pCenter;
         start = range.convertFrom0to1(jlimit(0.f, 1.f, pCenter-pOffset)) - center;
@@ -302,13 +922,8 @@ void MappingTargetModel::setMapping(MappingSourceModel* source, float e, bool se
         DBG("End: " + String(end));
     }
     
-    float* sourceArray =
-    *source->getValuePointerArray(processor.invParameterSkews.indexOf(invSkew));
-    for (auto param : targetParameters)
-    {
-        param->setHook(source->name, index, &sourceArray[i%n], start, end);
-        i++;
-    }
+    float* sourceArray = *source->getValuePointerArray(sourceSkew);
+    store.setHook(paramId, index, sourceArray, n, start, end);
     
     if (onMappingChange != nullptr) onMappingChange(true, sendChangeEvent);
 }
@@ -322,17 +937,14 @@ void MappingTargetModel::setMappingRange(float e, bool sendChangeEvent,
     end = e;
     if (bipolar)
     {
-        NormalisableRange<float>& range = targetParameters[0]->getRange();
-        float center = targetParameters[0]->getRawValue();
+        NormalisableRange<float>& range = store.getRange(paramId);
+        float center = store.getRawValue(paramId);
         float pCenter = range.convertTo0to1(center);
         float pOffset = range.convertTo0to1(range.getRange().clipValue(center+end)) - pCenter;
         start = range.convertFrom0to1(jlimit(0.f, 1.f, pCenter-pOffset)) - center;
     }
     
-    for (auto param : targetParameters)
-    {
-        param->setHookRange(index, start, end);
-    }
+    store.setHookRange(paramId, index, start, end);
     DBG(String(start) + " " + String(end));
     
     if (onMappingChange != nullptr && sendChangeEvent) onMappingChange(directChange, sendListenerNotif);
@@ -344,56 +956,58 @@ void MappingTargetModel::setMappingScalar(MappingSourceModel* source, bool sendC
     
     if (currentScalarSource != nullptr)
     {
+        currentScalarSource->removeMapping();
         processor.sourceMappingCounts.getReference(currentScalarSource->name)--;
     }
+    source->addMapping();
     processor.sourceMappingCounts.getReference(source->name)++;
     
     currentScalarSource = source;
     
-    int i = 0;
     int n = source->getNumSourcePointers();
     
     float* sourceArray = *source->getValuePointerArray(0);
-    for (auto param : targetParameters)
-    {
-        param->setHookScalar(source->name, index, &sourceArray[i%n]);
-        i++;
-    }
+    store.setHookScalar(paramId, index, sourceArray, n);
     
     if (onMappingChange != nullptr) onMappingChange(true, sendChangeEvent);
 }
 
 void MappingTargetModel::removeMapping(bool sendChangeEvent)
 {
+    if (currentSource == nullptr) return;
+    
+    currentSource->removeMapping();
     processor.sourceMappingCounts.getReference(currentSource->name)--;
+    currentSource->removeSkewUser(sourceSkew);
+    sourceSkew = 0;
+    
+    // The scalar goes along with the mapping
+    if (currentScalarSource != nullptr)
+    {
+        currentScalarSource->removeMapping();
+        processor.sourceMappingCounts.getReference(currentScalarSource->name)--;
+    }
     
     currentSource = nullptr;
     currentScalarSource = nullptr;
     
     start = end = 0.f;
     
-    for (auto param : targetParameters)
-    {
-        param->resetHook(index);
-    }
+    store.resetHook(paramId, index);
     
     if (onMappingChange != nullptr) onMappingChange(true, sendChangeEvent);
 }
 
 void MappingTargetModel::removeScalar(bool sendChangeEvent)
 {
+    if (currentScalarSource == nullptr) return;
+    
+    currentScalarSource->removeMapping();
     processor.sourceMappingCounts.getReference(currentScalarSource->name)--;
-    if (currentScalarSource != nullptr)
-    {
-        processor.sourceMappingCounts.getReference(currentScalarSource->name)--;
-    }
     
     currentScalarSource = nullptr;
     
-    for (auto param : targetParameters)
-    {
-        param->resetHookScalar(index);
-    }
+    store.resetHookScalar(paramId, index);
     
     if (onMappingChange != nullptr) onMappingChange(true, sendChangeEvent);
 }
@@ -405,23 +1019,24 @@ AudioComponent::AudioComponent(const String& n, ElectroAudioProcessor& p,
                                bool toggleable) :
 name(n),
 processor(p),
+state(ComponentState::acquire(p)),
 vts(vts),
+params(vts, n, s),
 paramNames(s),
 toggleable(toggleable)
 {
+    // Stands in for the SmoothedParameters each component used to add to
+    // processor.params
+    state.parameterStores.add(&params);
+    
     for (int i = 0; i < paramNames.size(); ++i)
     {
         String pn = name + " " + paramNames[i];
-        params.add(new OwnedArray<SmoothedParameter>());
-        for (int v = 0; v < NUM_STRINGS; ++v)
-        {
-            params[i]->add(new SmoothedParameter(p, vts, pn));
-            quickParams[i][v] = params[i]->getUnchecked(v);
-        }
+        quickParams[i] = &params.getLanes(i);
         for (int t = 0; t < 3; ++t)
         {
             String targetName = pn + " T" + String(t+1);
-            targets.add(new MappingTargetModel(processor, targetName, *params.getLast(), t));
+            targets.add(new MappingTargetModel(processor, targetName, params, i, t));
             processor.addMappingTarget(targets.getLast());
         }
     }
@@ -438,6 +1053,8 @@ toggleable(toggleable)
 
 AudioComponent::~AudioComponent()
 {
+    state.parameterStores.removeFirstMatchingValue(&params);
+    ComponentState::release(processor);
 }
 
 void AudioComponent::prepareToPlay (double sampleRate, int samplesPerBlock)
@@ -446,15 +1063,21 @@ void AudioComponent::prepareToPlay (double sampleRate, int samplesPerBlock)
     currentBlockSize = samplesPerBlock;
     invBlockSize = 1.f/currentBlockSize;
     
+    params.prepareToPlay(sampleRate, samplesPerBlock);
+    sampleInBlock = 0;
+    samplesInLastBlock = 0;
+    
     for (auto target : targets)
     {
         target->prepareToPlay();
     }
 }
 
-OwnedArray<SmoothedParameter>& AudioComponent::getParameterArray(int p)
+void AudioComponent::frame()
 {
-    return *params[p];
+    samplesInLastBlock = jmin(sampleInBlock, currentBlockSize);
+    sampleInBlock = 0;
+    params.frame();
 }
 
 MappingTargetModel* AudioComponent::getTarget(int paramId, int index)
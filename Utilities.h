@@ -12,8 +12,29 @@
 
 #include <JuceHeader.h>
 #include "../Constants.h"
+#include "SkewCurve.h"
 
 class ElectroAudioProcessor;
+class MappingSourceModel;
+class AudioComponent;
+
+#define MAX_NUM_MAPPING_SOURCES 128
+
+// Voice lanes are padded out to a multiple of 4 so they can be processed
+// with 128-bit vectors without a scalar tail
+#define NUM_VOICE_LANES ((NUM_STRINGS + 3) & ~3)
+#define DEFAULT_CONTROL_INTERVAL 16
+
+// How often a modulated parameter needs its mappings evaluated. Control rate
+// parameters are evaluated every control interval and interpolated between,
+// block rate parameters are evaluated once at the start of each block
+typedef enum
+{
+    AudioRate = 0,
+    ControlRate,
+    BlockRate,
+    ParameterRateNil
+} ParameterRate;
 
 //==============================================================================
 class ParameterHook
@@ -53,6 +74,20 @@ public:
 
 //==============================================================================
 //==============================================================================
+// Linear SmoothedValue that exposes how far into its ramp it is, so the rest
+// of the ramp can be written out for a whole block at once
+class BlockSmoothedValue : public SmoothedValue<float, ValueSmoothingTypes::Linear>
+{
+public:
+    int getRemainingSteps() const { return this->countdown; }
+    
+    // Writes the next numSamples values getNextValue() would return, without
+    // moving the ramp. Follow with skip() for the samples actually used
+    void renderRamp(float* out, int numSamples) const;
+};
+
+//==============================================================================
+
 class SmoothedParameter
 {
 public:
@@ -71,6 +106,13 @@ public:
     void tickSkewsNoSmoothing();
     void tickSkewsNoHooksNoSmoothing();
     
+    // Block versions write numSamples values to out. The smoothed version
+    // doesn't move the smoother, so call advance() with the number of
+    // samples actually used
+    void tickBlockNoHooks(float* out, int numSamples);
+    void tickBlockNoHooksNoSmoothing(float* out, int numSamples);
+    void advance(int numSamples);
+    
     float skip(int numSamples);
 
     float get();
@@ -94,11 +136,12 @@ public:
     float getInvSkew() { return 1.f/range.skew; }
     NormalisableRange<float>& getRange() { return range; }
     float getRawValue() { return *raw; }
+    bool hasHooks() { return numActiveHooks > 0; }
     
 private:
     ElectroAudioProcessor& processor;
     
-    SmoothedValue<float, ValueSmoothingTypes::Linear> smoothed;
+    BlockSmoothedValue smoothed;
     std::atomic<float>* raw;
     RangedAudioParameter* parameter;
     NormalisableRange<float> range;
@@ -117,6 +160,299 @@ private:
 //==============================================================================
 //==============================================================================
 
+// Hot per-voice state of one component parameter. Every field is a lane of
+// NUM_VOICE_LANES so a parameter can be updated for all voices in one pass.
+struct alignas(16) ParameterLanes
+{
+    float current[NUM_VOICE_LANES];
+    float next[NUM_VOICE_LANES];
+    float target[NUM_VOICE_LANES];
+    float step[NUM_VOICE_LANES];
+    int countdown[NUM_VOICE_LANES];
+    
+    float base;
+    bool smoothed;
+    
+    // Unmodulated smoothed parameters only get a new target once per block,
+    // so their ramp is rendered in frame() as rampLength rows of lanes
+    float* ramp;
+    int rampLength;
+    bool rampRendered;
+};
+
+//==============================================================================
+
+// Objects the audio thread is done with, handed to another thread to free
+// without either side locking. T needs a T* nextRetired member
+template <typename T>
+class RetiredList
+{
+public:
+    // Audio thread
+    void push(T* object)
+    {
+        if (object == nullptr) return;
+        object->nextRetired = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(object->nextRetired, object,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed));
+    }
+    
+    // Takes everything pushed so far and hands each one to free
+    template <typename FreeFunction>
+    void collect(FreeFunction&& free)
+    {
+        T* retired = head.exchange(nullptr, std::memory_order_acquire);
+        while (retired != nullptr)
+        {
+            T* next = retired->nextRetired;
+            free(retired);
+            retired = next;
+        }
+    }
+    
+private:
+    std::atomic<T*> head { nullptr };
+};
+
+//==============================================================================
+
+// One active mapping, flattened. Sources and scalars are read as voice lanes
+// with a stride of 1, or as a single value with a stride of 0
+struct ModulationRouting
+{
+    const float* source;
+    const float* scalar;
+    int sourceStride;
+    int scalarStride;
+    int target;
+    float min, length;
+};
+
+// Immutable once published. Edits on the message thread build a new table
+// and hand it to the audio thread, which swaps it in at the start of a block
+struct ModulationTable
+{
+    // Grouped by the rate of their target, ending at rateEnd[rate]
+    HeapBlock<ModulationRouting> routings;
+    HeapBlock<bool> isModulated;
+    HeapBlock<ParameterRate> rates;
+    int rateEnd[ParameterRateNil];
+    int numRoutings = 0;
+    ModulationTable* nextRetired = nullptr;
+};
+
+//==============================================================================
+
+class ParameterStore
+{
+public:
+    //==============================================================================
+    ParameterStore(AudioProcessorValueTreeState& vts, const String& prefix,
+                   const StringArray& paramNames);
+    ~ParameterStore();
+    
+    //==============================================================================
+    void prepareToPlay(double sampleRate, int samplesPerBlock);
+    void frame();
+    void tick();
+    
+    // True when nothing is modulated or smoothed, so the values set in frame()
+    // hold for the whole block and skip() can stand in for calls to tick()
+    bool isStatic();
+    void skip(int numSamples);
+    bool isModulated(int p) { return table->isModulated[p]; }
+    // Jumps every lane straight to its parameter's value, with no smoothing,
+    // at the start of the next block. For after a preset is restored
+    void reset() { resetPending.store(true, std::memory_order_relaxed); }
+    
+    //==============================================================================
+    int size() { return numParams; }
+    ParameterLanes& getLanes(int p) { return lanes[p]; }
+    void setSmoothed(int p, bool smoothed);
+    void setRate(int p, ParameterRate rate);
+    void setControlInterval(int numSamples);
+    // The interval in use for this block
+    int getControlInterval() { return controlInterval; }
+    
+    void setHook(int p, int index, const float* sources, int numSources,
+                 float min, float max);
+    void setHookRange(int p, int index, float min, float max);
+    void setHookScalar(int p, int index, const float* scalars, int numScalars);
+    void resetHook(int p, int index);
+    void resetHookScalar(int p, int index);
+    
+    float getInvSkew(int p) { return 1.f/ranges.getReference(p).skew; }
+    NormalisableRange<float>& getRange(int p) { return ranges.getReference(p); }
+    float getRawValue(int p) { return *raws[p]; }
+    
+    static const float unitScalar;
+    
+private:
+    struct HookSettings
+    {
+        const float* source = nullptr;
+        int numSources = 1;
+        float min = 0.f, max = 0.f;
+        const float* scalar = &unitScalar;
+        int numScalars = 1;
+    };
+    
+    void compileRoutings();
+    void collectRetiredTables();
+    void renderRamp(ParameterLanes& l);
+    void applyRoutings(int start, int end);
+    
+    HeapBlock<ParameterLanes> lanes;
+    HeapBlock<float> rampData;
+    
+    // Message thread only
+    Array<HookSettings> hooks;
+    Array<ParameterRate> rates;
+    
+    // Audio thread only, replaced from pendingTable in frame()
+    ModulationTable* table;
+    std::atomic<ModulationTable*> pendingTable { nullptr };
+    // Tables the audio thread is done with, freed from the message thread
+    RetiredList<ModulationTable> retiredTables;
+    Array<std::atomic<float>*> raws;
+    Array<NormalisableRange<float>> ranges;
+    int numParams;
+    int stepsToTarget = 0;
+    int blockSize = 0;
+    int tickIndex = 0;
+    
+    std::atomic<int> pendingControlInterval { DEFAULT_CONTROL_INTERVAL };
+    int controlInterval = DEFAULT_CONTROL_INTERVAL;
+    float invControlInterval = 1.f / DEFAULT_CONTROL_INTERVAL;
+    int controlCountdown = 0;
+    
+    std::atomic<bool> resetPending { false };
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ParameterStore)
+};
+
+//==============================================================================
+//==============================================================================
+
+// Voices that are sounding, kept as a bitmask and as a compact ascending
+// list so per voice loops can skip silent strings. Only changed on the
+// audio thread, at note on and when a voice's envelope goes idle
+class ActiveVoices
+{
+public:
+    ActiveVoices();
+    
+    void add(int v);
+    void remove(int v);
+    void removeAll(uint32 voiceMask);
+    void clear();
+    
+    bool contains(int v) { return (mask >> v) & 1u; }
+    uint32 getMask() { return mask; }
+    int size() { return numVoices; }
+    int operator[](int i) { return voices[i]; }
+    
+    const int* begin() const { return voices; }
+    const int* end() const { return voices + numVoices; }
+    
+    //==============================================================================
+    // A removed voice keeps ringing in the filters and output, so those walk
+    // the audible list instead, which also has removed voices until
+    // removeQuiet() lets them go. Adding a voice again stops it ringing
+    struct Range
+    {
+        const int* first;
+        const int* last;
+        const int* begin() const { return first; }
+        const int* end() const { return last; }
+    };
+    Range audible() const { return { audibleVoices, audibleVoices + numAudible }; }
+    bool isRinging(int v) { return (ringing >> v) & 1u; }
+    void removeQuiet(uint32 voiceMask);
+    
+private:
+    void rebuild();
+    
+    uint32 mask = 0;
+    int voices[NUM_STRINGS];
+    int numVoices = 0;
+    
+    uint32 ringing = 0;
+    int audibleVoices[NUM_STRINGS];
+    int numAudible = 0;
+    
+    static_assert(NUM_STRINGS <= 32, "ActiveVoices keeps one bit per voice");
+};
+
+//==============================================================================
+
+// Gives every mapping source a dense id and keeps how many targets use
+// each one in a fixed array, so the audio thread can check a source with
+// a single atomic load instead of a lookup by name
+class MappingSourceRegistry
+{
+public:
+    MappingSourceRegistry();
+    ~MappingSourceRegistry() {};
+    
+    int add(MappingSourceModel* source);
+    int size() { return sources.size(); }
+    MappingSourceModel* getSource(int id) { return sources[id]; }
+    
+    void addMapping(int id);
+    void removeMapping(int id);
+    
+    std::atomic<int>& getMappingCount(int id) { return mappingCounts[id]; }
+    
+private:
+    Array<MappingSourceModel*> sources;
+    std::atomic<int> mappingCounts[MAX_NUM_MAPPING_SOURCES];
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MappingSourceRegistry)
+};
+
+//==============================================================================
+
+// State every component of one processor shares. Kept here rather than on
+// ElectroAudioProcessor, made by the first component or source to acquire
+// it and freed when the last one releases it. The processor can reach it
+// with find() to walk the stores or clear the voices
+class ComponentState
+{
+public:
+    ~ComponentState() {};
+    
+    // Message thread
+    static ComponentState& acquire(ElectroAudioProcessor& p);
+    static void release(ElectroAudioProcessor& p);
+    // nullptr if nothing holds state for p
+    static ComponentState* find(ElectroAudioProcessor& p);
+    
+    MappingSourceRegistry sourceRegistry;
+    Array<ParameterStore*> parameterStores;
+    ActiveVoices activeVoices;
+    
+private:
+    ComponentState(ElectroAudioProcessor& p) : processor(&p) {};
+    
+    struct Registry
+    {
+        CriticalSection lock;
+        OwnedArray<ComponentState> states;
+    };
+    static Registry& getRegistry();
+    static ComponentState* findLocked(Registry& registry, ElectroAudioProcessor& p);
+    
+    ElectroAudioProcessor* processor;
+    int numUsers = 0;
+    
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (ComponentState)
+};
+
+//==============================================================================
+//==============================================================================
+
 class MappingSourceModel
 {
 public:
@@ -125,10 +461,29 @@ public:
     ~MappingSourceModel();
     
     bool isBipolar() { return bipolar; }
+    
+    int getSourceId() { return sourceId; }
+    // Whether any target is currently mapped to this source
+    bool isMapped() { return mappingCount->load(std::memory_order_relaxed) > 0; }
+    // Counts a target mapped to or unmapped from this source
+    void addMapping() { modelState.sourceRegistry.addMapping(sourceId); }
+    void removeMapping() { modelState.sourceRegistry.removeMapping(sourceId); }
 
     float** getValuePointerArray(int i);
     int getNumSourcePointers();
     
+    // Fills the skewed variants of this source that are mapped somewhere
+    // from the unskewed values
+    void computeSkews(int numValues);
+    // For a source rendering one value shared by every voice. Copies the
+    // first value of the unskewed and each skewed variant in use across
+    // numValues lanes, so per voice targets read it without remapping
+    void broadcast(int numValues);
+    
+    // Reference counts the skewed variants targets actually read from
+    void addSkewUser(int skewIndex);
+    void removeSkewUser(int skewIndex);
+    
     String name;
     float** sources[MAX_NUM_UNIQUE_SKEWS];
     int numSourcePointers;
@@ -137,6 +492,13 @@ public:
     
 private:
     ElectroAudioProcessor& modelProcessor;
+    ComponentState& modelState;
+    
+    int sourceId;
+    std::atomic<int>* mappingCount;
+    
+    int skewUsers[MAX_NUM_UNIQUE_SKEWS];
+    std::atomic<uint32> usedSkews { 0 };
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MappingSourceModel)
 };
@@ -148,8 +510,8 @@ class MappingTargetModel
 {
 public:
     
-    MappingTargetModel(ElectroAudioProcessor& p, const String &name, 
-                       OwnedArray<SmoothedParameter>& targetParameters, int index);
+    MappingTargetModel(ElectroAudioProcessor& p, const String &name,
+                       ParameterStore& store, int paramId, int index);
     ~MappingTargetModel();
     
     void prepareToPlay();
@@ -170,11 +532,13 @@ public:
     String name;
     MappingSourceModel* currentSource = nullptr;
     MappingSourceModel* currentScalarSource = nullptr;
-    OwnedArray<SmoothedParameter>& targetParameters;
+    ParameterStore& store;
+    int paramId;
     int index;
     float start, end;
     bool bipolar;
     float invSkew;
+    int sourceSkew = 0;
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MappingTargetModel)
 };
@@ -191,9 +555,11 @@ public:
     
     //==============================================================================
     void prepareToPlay (double sampleRate, int samplesPerBlock);
+    void frame();
     
     //==============================================================================
-    OwnedArray<SmoothedParameter>& getParameterArray(int p);
+    ParameterStore& getParameterStore() { return params; }
+    void setControlInterval(int numSamples) { params.setControlInterval(numSamples); }
     
     bool isToggleable() { return toggleable; }
     bool isEnabled() { return enabled; }
@@ -204,15 +570,21 @@ public:
     MappingTargetModel* getTarget(int paramId, int index);
     
 protected:
+    inline float getParameterValue(int p, int v)
+    {
+        return quickParams[p]->current[v];
+    }
+    
     String name;
         
     ElectroAudioProcessor& processor;
+    ComponentState& state;
     AudioProcessorValueTreeState& vts;
-    OwnedArray<OwnedArray<SmoothedParameter>> params;
+    ParameterStore params;
     StringArray paramNames;
     
     // First size needs to be at least the greatest number of params for any component
-    SmoothedParameter* quickParams[10][NUM_STRINGS];
+    ParameterLanes* quickParams[10];
     
     OwnedArray<MappingTargetModel> targets;
     
@@ -223,7 +595,8 @@ protected:
     int currentBlockSize = 0;
     float invBlockSize = 0.f;
     
-    int sampleInBlock;
+    int sampleInBlock = 0;
+    int samplesInLastBlock = 0;
     bool isOn;
     bool toggleable;
 };